@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "trie.h"
+
+#define USAGE "Usage: fcmpl_bench [--words N] [--min-len N] [--max-len N] [--skew S] " \
+    "[--seed N] [--corpus file]\n"
+
+/*
+ * Prefix of complete_topk queries is at most this long, so best-first search has to skip
+ * large subtrees
+ */
+#define TOPK_PREFIX_LEN 3
+
+/*
+ * Number of queries of completions and suggestions, slower per call than other operations
+ */
+#define COMPLETE_QUERIES 100000
+#define SUGGEST_QUERIES 1000
+
+/*
+ * Completion stops after this many words, like a page shown by an editor
+ */
+#define COMPLETE_PAGE 100
+
+/*
+ * Budget of completion cache measured by complete_cached
+ */
+#define COMPLETE_CACHE_BYTES (64 << 20)
+
+/*
+ * Journal written by put_journaled and replayed by replay_journal, removed afterwards
+ */
+#define BENCH_JOURNAL_FILE "/tmp/fcmpl_bench.journal"
+
+/*
+ * Corpus of NUL-terminated words stored back to back
+ */
+typedef struct
+{
+    char *text;
+    bulk_word *words;
+    size_t count;
+} corpus;
+
+typedef struct
+{
+    size_t words;
+    size_t min_len;
+    size_t max_len;
+    double skew; // exponent of Zipf distribution of letters, 0 is uniform
+    uint64_t seed;
+    const char *path; // corpus file, synthetic corpus is generated if NULL
+} bench_config;
+
+/*
+ * Latencies of single calls of one operation
+ */
+typedef struct
+{
+    uint64_t *ns;
+    size_t count;
+    size_t capacity;
+} samples;
+
+typedef struct
+{
+    size_t found;
+    size_t left; // words still accepted for the current query
+} page;
+
+static bool parse_args(int argc, char **argv, bench_config *cfg);
+static bool generate_corpus(const bench_config *cfg, corpus *c);
+static bool read_corpus(const char *path, corpus *c);
+static uint64_t next_random(uint64_t *state);
+static uint64_t now_ns();
+static bool record(samples *s, uint64_t ns);
+static void report(const char *op, samples *s, size_t items, uint64_t total_ns);
+static void report_single(const char *op, size_t items, uint64_t ns);
+static int cmp_u64(const void *a, const void *b);
+static bool count_word(const char *word, size_t len, void *ctx);
+static bool page_word(const char *word, size_t len, void *ctx);
+static void shuffle(size_t *order, size_t count, uint64_t *state);
+static int cmp_bulk_word(const void *a, const void *b);
+
+static const char *letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/*
+ * Measures single operations on a corpus and prints one JSON object per line:
+ * {"op", "calls", "items", "seconds", "items_per_sec", "p50_ns", "p99_ns", "p999_ns"}.
+ * Bulk operations (loads, generate) are timed as a whole and have no percentiles.
+ */
+int main(int argc, char **argv)
+{
+    bench_config cfg = {
+	.words = 1000000, .min_len = 3, .max_len = 12, .skew = 1.0, .seed = 1, .path = NULL
+    };
+    if (!parse_args(argc, argv, &cfg)) {
+	fprintf(stderr, USAGE);
+	return 1;
+    }
+
+    corpus c;
+    if (cfg.path != NULL ? !read_corpus(cfg.path, &c) : !generate_corpus(&cfg, &c)) {
+	return 1;
+    }
+    size_t *order = malloc(sizeof(size_t) * c.count);
+    samples s = { .ns = malloc(sizeof(uint64_t) * c.count), .capacity = c.count };
+    trie *t = create_trie();
+    if (order == NULL || s.ns == NULL || t == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return 1;
+    }
+    uint64_t state = cfg.seed;
+    for (size_t i = 0; i < c.count; i++) {
+	order[i] = i;
+    }
+    shuffle(order, c.count, &state);
+
+    printf("{\"op\":\"config\",\"words\":%zu,\"min_len\":%zu,\"max_len\":%zu,\"skew\":%.2f,"
+	   "\"seed\":%llu,\"corpus\":\"%s\"}\n", c.count, cfg.min_len, cfg.max_len, cfg.skew,
+	   (unsigned long long) cfg.seed, cfg.path != NULL ? cfg.path : "synthetic");
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < c.count; i++) {
+	const char *word = c.words[order[i]].word;
+	uint64_t t0 = now_ns();
+	put(t, word);
+	record(&s, now_ns() - t0);
+    }
+    report("put", &s, c.count, now_ns() - start);
+
+    shuffle(order, c.count, &state);
+    start = now_ns();
+    for (size_t i = 0; i < c.count; i++) {
+	const char *word = c.words[order[i]].word;
+	uint64_t t0 = now_ns();
+	check(t, word);
+	record(&s, now_ns() - t0);
+    }
+    report("check", &s, c.count, now_ns() - start);
+
+    // prefix is the first half of a word
+    size_t queries = c.count < COMPLETE_QUERIES ? c.count : COMPLETE_QUERIES;
+    page pg = { .found = 0 };
+    start = now_ns();
+    for (size_t i = 0; i < queries; i++) {
+	const bulk_word *bw = &c.words[order[i]];
+	size_t len = (bw->len + 1) / 2;
+	char prefix[MAX_WORD_LEN + 1];
+	memcpy(prefix, bw->word, len);
+	prefix[len] = '\0';
+	pg.left = COMPLETE_PAGE;
+	uint64_t t0 = now_ns();
+	complete(t, prefix, page_word, &pg);
+	record(&s, now_ns() - t0);
+    }
+    report("complete", &s, pg.found, now_ns() - start);
+
+    // same queries again, the second pass is answered by completion cache
+    if (!enable_completion_cache(t, COMPLETE_CACHE_BYTES)) {
+	return 1;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+	pg.found = 0;
+	start = now_ns();
+	for (size_t i = 0; i < queries; i++) {
+	    const bulk_word *bw = &c.words[order[i]];
+	    size_t len = (bw->len + 1) / 2;
+	    char prefix[MAX_WORD_LEN + 1];
+	    memcpy(prefix, bw->word, len);
+	    prefix[len] = '\0';
+	    pg.left = COMPLETE_PAGE;
+	    uint64_t t0 = now_ns();
+	    complete(t, prefix, page_word, &pg);
+	    if (pass == 1) {
+		record(&s, now_ns() - t0);
+	    }
+	}
+    }
+    report("complete_cached", &s, pg.found, now_ns() - start);
+
+    // prefixes typed char by char, a page of completions after every keystroke
+    completion_session *session = session_begin(t);
+    if (session == NULL) {
+	return 1;
+    }
+    pg.found = 0;
+    start = now_ns();
+    for (size_t i = 0; i < queries; i++) {
+	const bulk_word *bw = &c.words[order[i]];
+	size_t len = (bw->len + 1) / 2;
+	while (session_pop_char(session)) {
+	}
+	for (size_t j = 0; j < len; j++) {
+	    pg.left = COMPLETE_PAGE;
+	    uint64_t t0 = now_ns();
+	    session_push_char(session, bw->word[j]);
+	    session_complete(session, page_word, &pg);
+	    record(&s, now_ns() - t0);
+	}
+    }
+    report("session_keystroke", &s, pg.found, now_ns() - start);
+    session_end(session);
+
+    size_t found = 0;
+    start = now_ns();
+    for (size_t i = 0; i < queries; i++) {
+	const bulk_word *bw = &c.words[order[i]];
+	char prefix[TOPK_PREFIX_LEN + 1];
+	size_t len = bw->len < TOPK_PREFIX_LEN ? bw->len : TOPK_PREFIX_LEN;
+	memcpy(prefix, bw->word, len);
+	prefix[len] = '\0';
+	uint64_t t0 = now_ns();
+	complete_topk(t, prefix, 10, count_word, &found);
+	record(&s, now_ns() - t0);
+    }
+    report("complete_topk", &s, found, now_ns() - start);
+
+    // words with one substituted letter, corrected within two edits
+    size_t suggest_queries = c.count < SUGGEST_QUERIES ? c.count : SUGGEST_QUERIES;
+    found = 0;
+    start = now_ns();
+    for (size_t i = 0; i < suggest_queries; i++) {
+	char word[MAX_WORD_LEN + 1];
+	const bulk_word *bw = &c.words[order[i]];
+	memcpy(word, bw->word, bw->len + 1);
+	word[next_random(&state) % bw->len] = letters[next_random(&state) % 26];
+	uint64_t t0 = now_ns();
+	found += suggest(t, word, 2, 10, count_word, NULL) > 0;
+	record(&s, now_ns() - t0);
+    }
+    report("suggest", &s, suggest_queries, now_ns() - start);
+
+    FILE *null_fp = fopen("/dev/null", "w");
+    if (null_fp != NULL) {
+	start = now_ns();
+	generate_txt_file(null_fp, t);
+	report_single("generate_txt_file", t->size, now_ns() - start);
+	fclose(null_fp);
+    }
+
+    // half of the words are deleted, so pruning and node shrinking are part of the cost
+    shuffle(order, c.count, &state);
+    start = now_ns();
+    for (size_t i = 0; i < c.count / 2; i++) {
+	const char *word = c.words[order[i]].word;
+	uint64_t t0 = now_ns();
+	delete(t, word);
+	record(&s, now_ns() - t0);
+    }
+    report("delete", &s, c.count / 2, now_ns() - start);
+
+    reset_trie(t);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    start = now_ns();
+    put_parallel(t, c.words, c.count, cpus > 0 ? cpus : 1);
+    report_single("load_parallel", c.count, now_ns() - start);
+
+    qsort(c.words, c.count, sizeof(bulk_word), cmp_bulk_word);
+    reset_trie(t);
+    start = now_ns();
+    put_sorted(t, c.words, c.count);
+    report_single("load_sorted", c.count, now_ns() - start);
+
+    // puts of every sync interval share a single fsync, snapshots of automatic compactions are included
+    free_trie(t);
+    remove(BENCH_JOURNAL_FILE);
+    t = create_trie();
+    if (t == NULL || !enable_journal(t, BENCH_JOURNAL_FILE)) {
+	return 1;
+    }
+    shuffle(order, c.count, &state);
+    start = now_ns();
+    for (size_t i = 0; i < c.count; i++) {
+	const char *word = c.words[order[i]].word;
+	uint64_t t0 = now_ns();
+	put(t, word);
+	record(&s, now_ns() - t0);
+    }
+    sync_journal(t);
+    report("put_journaled", &s, c.count, now_ns() - start);
+
+    start = now_ns();
+    compact_journal(t);
+    report_single("compact_journal", t->size, now_ns() - start);
+    free_trie(t);
+
+    t = create_trie();
+    start = now_ns();
+    if (t == NULL || !enable_journal(t, BENCH_JOURNAL_FILE)) {
+	return 1;
+    }
+    report_single("replay_journal", t->size, now_ns() - start);
+    remove(BENCH_JOURNAL_FILE);
+
+    free_trie(t);
+    free(s.ns);
+    free(order);
+    free(c.words);
+    free(c.text);
+    return 0;
+}
+
+static bool parse_args(int argc, char **argv, bench_config *cfg)
+{
+    for (int i = 1; i < argc; i++) {
+	if (i + 1 == argc) {
+	    return false;
+	}
+	const char *value = argv[++i];
+	if (strcmp(argv[i - 1], "--words") == 0) {
+	    cfg->words = strtoull(value, NULL, 10);
+	} else if (strcmp(argv[i - 1], "--min-len") == 0) {
+	    cfg->min_len = strtoull(value, NULL, 10);
+	} else if (strcmp(argv[i - 1], "--max-len") == 0) {
+	    cfg->max_len = strtoull(value, NULL, 10);
+	} else if (strcmp(argv[i - 1], "--skew") == 0) {
+	    cfg->skew = strtod(value, NULL);
+	} else if (strcmp(argv[i - 1], "--seed") == 0) {
+	    cfg->seed = strtoull(value, NULL, 10);
+	} else if (strcmp(argv[i - 1], "--corpus") == 0) {
+	    cfg->path = value;
+	} else {
+	    return false;
+	}
+    }
+    return cfg->words > 0 && cfg->min_len > 0 && cfg->min_len <= cfg->max_len
+	&& cfg->max_len <= MAX_WORD_LEN && cfg->skew >= 0;
+}
+
+/*
+ * Words of uniformly distributed length over lowercase letters, letter of rank r is drawn
+ * with weight 1 / (r + 1) ^ skew, so higher skew makes prefixes shared by more words
+ */
+static bool generate_corpus(const bench_config *cfg, corpus *c)
+{
+    double cdf[26];
+    double total = 0;
+    for (int r = 0; r < 26; r++) {
+	total += 1 / pow(r + 1, cfg->skew);
+	cdf[r] = total;
+    }
+
+    c->count = cfg->words;
+    c->text = malloc(cfg->words * (cfg->max_len + 1));
+    c->words = malloc(sizeof(bulk_word) * cfg->words);
+    if (c->text == NULL || c->words == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return false;
+    }
+    uint64_t state = cfg->seed;
+    char *p = c->text;
+    for (size_t i = 0; i < cfg->words; i++) {
+	size_t len = cfg->min_len + next_random(&state) % (cfg->max_len - cfg->min_len + 1);
+	c->words[i] = (bulk_word) { .word = p, .len = len };
+	for (size_t j = 0; j < len; j++) {
+	    double x = (next_random(&state) >> 11) * (1.0 / (1ULL << 53)) * total;
+	    int r = 0;
+	    while (r < 25 && cdf[r] < x) {
+		r++;
+	    }
+	    *p++ = letters[r];
+	}
+	*p++ = '\0';
+    }
+    return true;
+}
+
+/*
+ * Reads newline separated words, lines which aren't valid words are skipped
+ */
+static bool read_corpus(const char *path, corpus *c)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+	fprintf(stderr, "File couldn't be opened\n");
+	return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    c->text = malloc(size + 1);
+    c->words = malloc(sizeof(bulk_word) * (size / 2 + 1));
+    if (c->text == NULL || c->words == NULL || fread(c->text, 1, size, fp) != (size_t) size) {
+	fprintf(stderr, "File couldn't be read\n");
+	fclose(fp);
+	return false;
+    }
+    fclose(fp);
+    c->text[size] = '\0';
+
+    c->count = 0;
+    for (char *line = c->text; *line != '\0'; ) {
+	char *eol = strchr(line, '\n');
+	if (eol == NULL) {
+	    eol = line + strlen(line);
+	}
+	char *end = line;
+	while (end < eol && hash(*end) != -1) {
+	    end++;
+	}
+	char *next = *eol == '\0' ? eol : eol + 1;
+	*end = '\0';
+	if (end > line && end - line <= MAX_WORD_LEN) {
+	    c->words[c->count++] = (bulk_word) { .word = line, .len = end - line };
+	}
+	line = next;
+    }
+    return c->count > 0;
+}
+
+/*
+ * xorshift64*, same seed gives same corpus and order on every machine
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state != 0 ? *state : 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool record(samples *s, uint64_t ns)
+{
+    if (s->count == s->capacity) {
+	return false;
+    }
+    s->ns[s->count++] = ns;
+    return true;
+}
+
+/*
+ * Prints throughput of items over whole run and percentiles of recorded calls, then
+ * clears samples
+ */
+static void report(const char *op, samples *s, size_t items, uint64_t total_ns)
+{
+    qsort(s->ns, s->count, sizeof(uint64_t), cmp_u64);
+    uint64_t p50 = 0, p99 = 0, p999 = 0;
+    if (s->count > 0) {
+	p50 = s->ns[s->count * 50 / 100];
+	p99 = s->ns[s->count * 99 / 100];
+	p999 = s->ns[s->count * 999 / 1000];
+    }
+    double seconds = total_ns / 1e9;
+    printf("{\"op\":\"%s\",\"calls\":%zu,\"items\":%zu,\"seconds\":%.6f,\"items_per_sec\":%.0f,"
+	   "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu}\n", op, s->count, items, seconds,
+	   seconds > 0 ? items / seconds : 0, (unsigned long long) p50,
+	   (unsigned long long) p99, (unsigned long long) p999);
+    s->count = 0;
+}
+
+static void report_single(const char *op, size_t items, uint64_t ns)
+{
+    double seconds = ns / 1e9;
+    printf("{\"op\":\"%s\",\"calls\":1,\"items\":%zu,\"seconds\":%.6f,\"items_per_sec\":%.0f}\n",
+	   op, items, seconds, seconds > 0 ? items / seconds : 0);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static bool count_word(const char *word, size_t len, void *ctx)
+{
+    (void) word;
+    (void) len;
+    if (ctx != NULL) {
+	(*(size_t *) ctx)++;
+    }
+    return true;
+}
+
+static bool page_word(const char *word, size_t len, void *ctx)
+{
+    (void) word;
+    (void) len;
+    page *pg = ctx;
+    if (pg->left == 0) {
+	return false;
+    }
+    pg->left--;
+    pg->found++;
+    return true;
+}
+
+static void shuffle(size_t *order, size_t count, uint64_t *state)
+{
+    for (size_t i = count; i > 1; i--) {
+	size_t j = next_random(state) % i;
+	size_t tmp = order[i - 1];
+	order[i - 1] = order[j];
+	order[j] = tmp;
+    }
+}
+
+static int cmp_bulk_word(const void *a, const void *b)
+{
+    return strcmp(((const bulk_word *) a)->word, ((const bulk_word *) b)->word);
+}
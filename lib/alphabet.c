@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "alphabet.h"
+
+/*
+ * Tables are generated by the preprocessor from the ranges of the preset, 16 entries per row
+ */
+#define ROW(f, base) f((base) + 0), f((base) + 1), f((base) + 2), f((base) + 3), \
+	f((base) + 4), f((base) + 5), f((base) + 6), f((base) + 7), \
+	f((base) + 8), f((base) + 9), f((base) + 10), f((base) + 11), \
+	f((base) + 12), f((base) + 13), f((base) + 14), f((base) + 15)
+
+#define TABLE(f) ROW(f, 0x00), ROW(f, 0x10), ROW(f, 0x20), ROW(f, 0x30), \
+	ROW(f, 0x40), ROW(f, 0x50), ROW(f, 0x60), ROW(f, 0x70), \
+	ROW(f, 0x80), ROW(f, 0x90), ROW(f, 0xA0), ROW(f, 0xB0), \
+	ROW(f, 0xC0), ROW(f, 0xD0), ROW(f, 0xE0), ROW(f, 0xF0)
+
+// ranges are disjoint, so at most one term of the sum is non-zero
+#define SLOT_TERM(ch, lo, hi, base) + ((ch) >= (lo) && (ch) <= (hi) ? (ch) - (lo) + (base) + 1 : 0)
+#define CHAR_TERM(idx, lo, hi, base) + ((idx) >= (base) && (idx) <= (base) + (hi) - (lo) ? (idx) - (base) + (lo) : 0)
+#define SLOT_ENTRY(ch) ((0 ALPHABET_RANGES(SLOT_TERM, ch)) - 1)
+#define CHAR_ENTRY(idx) (0 ALPHABET_RANGES(CHAR_TERM, idx))
+
+const short alphabet_slots[256] = { TABLE(SLOT_ENTRY) };
+
+const unsigned char alphabet_chars[256] = { TABLE(CHAR_ENTRY) };
+
+/*
+ * Range check of a vector of bytes, chars in [lo .. hi] get their slot in slots
+ * and set their lanes of valid
+ */
+#if defined(__AVX2__)
+#define VECTOR_WIDTH 32
+#define VECTOR_RANGE(v, lo, hi, base) { \
+	__m256i offset = _mm256_sub_epi8(v.chars, _mm256_set1_epi8((char) (lo))); \
+	__m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8((char) ((hi) - (lo)))), offset); \
+	v.slots = _mm256_or_si256(v.slots, _mm256_and_si256(in_range, _mm256_add_epi8(offset, _mm256_set1_epi8((char) (base))))); \
+	v.valid = _mm256_or_si256(v.valid, in_range); \
+    }
+#elif defined(__SSE2__)
+#define VECTOR_WIDTH 16
+#define VECTOR_RANGE(v, lo, hi, base) { \
+	__m128i offset = _mm_sub_epi8(v.chars, _mm_set1_epi8((char) (lo))); \
+	__m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8((char) ((hi) - (lo)))), offset); \
+	v.slots = _mm_or_si128(v.slots, _mm_and_si128(in_range, _mm_add_epi8(offset, _mm_set1_epi8((char) (base))))); \
+	v.valid = _mm_or_si128(v.valid, in_range); \
+    }
+#endif
+
+/*
+ * Validates len chars of word and writes slot of each of them into slots in the same pass.
+ * Returns false if any char is not in the alphabet, slots are undefined then.
+ * Chars are mapped a vector at a time with SSE2 or AVX2 when the target has them.
+ */
+bool map_word(const char *word, size_t len, unsigned char *slots)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + VECTOR_WIDTH <= len; i += VECTOR_WIDTH) {
+	struct { __m256i chars, slots, valid; } v = {
+	    _mm256_loadu_si256((const __m256i *) (word + i)), _mm256_setzero_si256(), _mm256_setzero_si256()
+	};
+	ALPHABET_RANGES(VECTOR_RANGE, v)
+	if ((unsigned int) _mm256_movemask_epi8(v.valid) != 0xFFFFFFFFu) {
+	    return false;
+	}
+	_mm256_storeu_si256((__m256i *) (slots + i), v.slots);
+    }
+#elif defined(__SSE2__)
+    for (; i + VECTOR_WIDTH <= len; i += VECTOR_WIDTH) {
+	struct { __m128i chars, slots, valid; } v = {
+	    _mm_loadu_si128((const __m128i *) (word + i)), _mm_setzero_si128(), _mm_setzero_si128()
+	};
+	ALPHABET_RANGES(VECTOR_RANGE, v)
+	if (_mm_movemask_epi8(v.valid) != 0xFFFF) {
+	    return false;
+	}
+	_mm_storeu_si128((__m128i *) (slots + i), v.slots);
+    }
+#endif
+    for (; i < len; i++) {
+	int idx = hash(word[i]);
+	if (idx == -1) {
+	    return false;
+	}
+	slots[i] = (unsigned char) idx;
+    }
+    return true;
+}
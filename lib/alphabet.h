@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#ifndef ALPHABET_H
+#define ALPHABET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Character set presets, selected at compile time with -D ALPHABET=<preset>.
+ * Slots follow byte order, so child order of nodes stays alphabetical.
+ */
+#define ALPHABET_LETTERS 1 // [A-Za-z]
+#define ALPHABET_LOWER 2 // [a-z]
+#define ALPHABET_ALNUM 3 // [0-9A-Za-z]
+#define ALPHABET_BYTES 4 // printable ASCII except space and every byte >= 0x80, e.g. UTF-8 text
+
+#ifndef ALPHABET
+#define ALPHABET ALPHABET_LETTERS
+#endif
+
+/*
+ * Preset is a list of disjoint byte ranges, X(arg, lo, hi, base) maps bytes [lo .. hi]
+ * to slots starting at base. NUMBER_OF_LETTERS is the number of slots.
+ */
+#if ALPHABET == ALPHABET_LETTERS
+#define NUMBER_OF_LETTERS 52
+#define ALPHABET_RANGES(X, arg) X(arg, 'A', 'Z', 0) X(arg, 'a', 'z', 26)
+#elif ALPHABET == ALPHABET_LOWER
+#define NUMBER_OF_LETTERS 26
+#define ALPHABET_RANGES(X, arg) X(arg, 'a', 'z', 0)
+#elif ALPHABET == ALPHABET_ALNUM
+#define NUMBER_OF_LETTERS 62
+#define ALPHABET_RANGES(X, arg) X(arg, '0', '9', 0) X(arg, 'A', 'Z', 10) X(arg, 'a', 'z', 36)
+#elif ALPHABET == ALPHABET_BYTES
+#define NUMBER_OF_LETTERS 222
+#define ALPHABET_RANGES(X, arg) X(arg, 0x21, 0x7E, 0) X(arg, 0x80, 0xFF, 94)
+#else
+#error "Unknown ALPHABET preset"
+#endif
+
+/*
+ * Slot of every byte, -1 if byte is not in the alphabet
+ */
+extern const short alphabet_slots[256];
+
+/*
+ * Byte of every slot, entries past NUMBER_OF_LETTERS are unused
+ */
+extern const unsigned char alphabet_chars[256];
+
+#define IS_VALID_CHAR(ch) (alphabet_slots[(unsigned char) (ch)] >= 0)
+
+/*
+ * Reverse of hash
+ */
+#define LETTER(idx) ((char) alphabet_chars[idx])
+
+/*
+ * Slot of ch between [0 .. NUMBER_OF_LETTERS), -1 if ch is not in the alphabet
+ */
+static inline int hash(char ch)
+{
+    return alphabet_slots[(unsigned char) ch];
+}
+
+bool map_word(const char *word, size_t len, unsigned char *slots);
+
+#endif // ALPHABET_H
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+static uint64_t prefix_hash(const char *prefix, size_t len);
+static uint64_t hash_step(uint64_t h, char ch);
+static cache_entry *find_entry(const completion_cache *c, const char *prefix, size_t len, uint64_t h);
+static void link_entry(completion_cache *c, cache_entry *e);
+static void unlink_entry(completion_cache *c, cache_entry *e);
+static void touch_entry(completion_cache *c, cache_entry *e);
+static void free_entry(cache_entry *e);
+static void grow_buckets(completion_cache *c);
+static void evict(completion_cache *c);
+
+completion_cache *create_completion_cache(size_t max_bytes)
+{
+    completion_cache *c = calloc(1, sizeof(completion_cache));
+    if (c == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return NULL;
+    }
+    c->buckets = calloc(CACHE_INITIAL_BUCKETS, sizeof(cache_entry *));
+    if (c->buckets == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	free(c);
+	return NULL;
+    }
+    c->bucket_count = CACHE_INITIAL_BUCKETS;
+    c->max_bytes = max_bytes;
+    c->generation = 1;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+/*
+ * Releases cache and every entry, no reader may be streaming a result
+ */
+void free_completion_cache(completion_cache *c)
+{
+    if (c == NULL) {
+	return;
+    }
+    cache_flush(c);
+    pthread_mutex_destroy(&c->lock);
+    free(c->buckets);
+    free(c);
+}
+
+/*
+ * Returns entry with stored result of prefix, which must be passed to cache_release once
+ * its words are consumed. On a miss NULL is returned and stamp receives the value to pass
+ * to cache_fill, 0 if another reader is already computing the result.
+ */
+cache_entry *cache_acquire(completion_cache *c, const char *prefix, size_t len, unsigned long *stamp)
+{
+    uint64_t h = prefix_hash(prefix, len);
+    *stamp = 0;
+    pthread_mutex_lock(&c->lock);
+    cache_entry *e = find_entry(c, prefix, len, h);
+    if (e != NULL && e->ready) {
+	e->refs++;
+	touch_entry(c, e);
+	c->hits++;
+	pthread_mutex_unlock(&c->lock);
+	return e;
+    }
+    c->misses++;
+    if (e == NULL) {
+	e = malloc(sizeof(cache_entry) + len);
+	if (e == NULL) {
+	    fprintf(stderr, "Memory allocation error\n");
+	} else {
+	    *e = (cache_entry) { .hash = h, .stamp = c->generation, .bytes = sizeof(cache_entry) + len,
+				 .prefix_len = len };
+	    memcpy(e->prefix, prefix, len);
+	    link_entry(c, e);
+	    *stamp = e->stamp;
+	}
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+void cache_release(completion_cache *c, cache_entry *e)
+{
+    pthread_mutex_lock(&c->lock);
+    bool last = --e->refs == 0 && !e->linked;
+    pthread_mutex_unlock(&c->lock);
+    if (last) {
+	free_entry(e);
+    }
+}
+
+/*
+ * Stores result computed after cache_acquire returned stamp, cache takes ownership of text.
+ * Result is dropped if the prefix was invalidated meanwhile.
+ */
+void cache_fill(completion_cache *c, const char *prefix, size_t len, unsigned long stamp,
+		char *text, size_t text_len, size_t count)
+{
+    if (stamp == 0) {
+	free(text);
+	return;
+    }
+    uint64_t h = prefix_hash(prefix, len);
+    pthread_mutex_lock(&c->lock);
+    cache_entry *e = find_entry(c, prefix, len, h);
+    if (e == NULL || e->ready || e->stamp != stamp) {
+	pthread_mutex_unlock(&c->lock);
+	free(text);
+	return;
+    }
+    if (e->bytes + text_len > c->max_bytes) {
+	unlink_entry(c, e);
+	pthread_mutex_unlock(&c->lock);
+	free_entry(e);
+	free(text);
+	return;
+    }
+    e->text = text;
+    e->count = count;
+    e->bytes += text_len;
+    e->ready = true;
+    c->bytes += text_len;
+    touch_entry(c, e);
+    evict(c);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * Gives up entry of prefix when its result can't be stored, e.g. the walk was stopped early
+ */
+void cache_abandon(completion_cache *c, const char *prefix, size_t len, unsigned long stamp)
+{
+    if (stamp == 0) {
+	return;
+    }
+    uint64_t h = prefix_hash(prefix, len);
+    pthread_mutex_lock(&c->lock);
+    cache_entry *e = find_entry(c, prefix, len, h);
+    if (e != NULL && !e->ready && e->stamp == stamp) {
+	unlink_entry(c, e);
+	free_entry(e);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * Removes entries of every prefix of word, results of other prefixes are unaffected.
+ * Called after word was added or deleted.
+ */
+void cache_invalidate(completion_cache *c, const char *word, size_t len)
+{
+    uint64_t h = FNV_OFFSET;
+    pthread_mutex_lock(&c->lock);
+    c->generation++;
+    for (size_t i = 0; i < len && c->count > 0; i++) {
+	h = hash_step(h, word[i]);
+	cache_entry *e = find_entry(c, word, i + 1, h);
+	if (e != NULL) {
+	    unlink_entry(c, e);
+	    if (e->refs == 0) {
+		free_entry(e);
+	    }
+	}
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * Removes every entry, used when the whole trie changes at once
+ */
+void cache_flush(completion_cache *c)
+{
+    pthread_mutex_lock(&c->lock);
+    c->generation++;
+    while (c->oldest != NULL) {
+	cache_entry *e = c->oldest;
+	unlink_entry(c, e);
+	if (e->refs == 0) {
+	    free_entry(e);
+	}
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/*
+ * FNV-1a, hashes of every prefix of a word are found in a single pass
+ */
+static uint64_t prefix_hash(const char *prefix, size_t len)
+{
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+	h = hash_step(h, prefix[i]);
+    }
+    return h;
+}
+
+static uint64_t hash_step(uint64_t h, char ch)
+{
+    return (h ^ (unsigned char) ch) * FNV_PRIME;
+}
+
+static cache_entry *find_entry(const completion_cache *c, const char *prefix, size_t len, uint64_t h)
+{
+    cache_entry *e = c->buckets[h & (c->bucket_count - 1)];
+    while (e != NULL && (e->hash != h || e->prefix_len != len || memcmp(e->prefix, prefix, len) != 0)) {
+	e = e->next;
+    }
+    return e;
+}
+
+/*
+ * Inserts entry into its bucket and as the newest one of LRU list
+ */
+static void link_entry(completion_cache *c, cache_entry *e)
+{
+    if (c->count >= c->bucket_count) {
+	grow_buckets(c);
+    }
+    cache_entry **bucket = &c->buckets[e->hash & (c->bucket_count - 1)];
+    e->next = *bucket;
+    *bucket = e;
+    e->older = c->newest;
+    e->newer = NULL;
+    if (c->newest != NULL) {
+	c->newest->newer = e;
+    } else {
+	c->oldest = e;
+    }
+    c->newest = e;
+    e->linked = true;
+    c->count++;
+    c->bytes += e->bytes;
+}
+
+static void unlink_entry(completion_cache *c, cache_entry *e)
+{
+    cache_entry **link = &c->buckets[e->hash & (c->bucket_count - 1)];
+    while (*link != e) {
+	link = &(*link)->next;
+    }
+    *link = e->next;
+    if (e->newer != NULL) {
+	e->newer->older = e->older;
+    } else {
+	c->newest = e->older;
+    }
+    if (e->older != NULL) {
+	e->older->newer = e->newer;
+    } else {
+	c->oldest = e->newer;
+    }
+    e->linked = false;
+    c->count--;
+    c->bytes -= e->bytes;
+}
+
+/*
+ * Moves entry to the newest end of LRU list
+ */
+static void touch_entry(completion_cache *c, cache_entry *e)
+{
+    if (c->newest == e) {
+	return;
+    }
+    e->newer->older = e->older;
+    if (e->older != NULL) {
+	e->older->newer = e->newer;
+    } else {
+	c->oldest = e->newer;
+    }
+    e->older = c->newest;
+    e->newer = NULL;
+    c->newest->newer = e;
+    c->newest = e;
+}
+
+static void free_entry(cache_entry *e)
+{
+    free(e->text);
+    free(e);
+}
+
+/*
+ * Doubles bucket array, keeps the current one if allocation fails
+ */
+static void grow_buckets(completion_cache *c)
+{
+    size_t bucket_count = c->bucket_count * 2;
+    cache_entry **buckets = calloc(bucket_count, sizeof(cache_entry *));
+    if (buckets == NULL) {
+	return;
+    }
+    for (size_t i = 0; i < c->bucket_count; i++) {
+	cache_entry *e = c->buckets[i];
+	while (e != NULL) {
+	    cache_entry *next = e->next;
+	    cache_entry **bucket = &buckets[e->hash & (bucket_count - 1)];
+	    e->next = *bucket;
+	    *bucket = e;
+	    e = next;
+	}
+    }
+    free(c->buckets);
+    c->buckets = buckets;
+    c->bucket_count = bucket_count;
+}
+
+/*
+ * Drops least recently used entries until stored results fit into the budget.
+ * Entry being streamed is freed by its last reader.
+ */
+static void evict(completion_cache *c)
+{
+    while (c->bytes > c->max_bytes && c->oldest != NULL) {
+	cache_entry *e = c->oldest;
+	unlink_entry(c, e);
+	if (e->refs == 0) {
+	    free_entry(e);
+	}
+    }
+}
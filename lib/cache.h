@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Initial number of hash buckets, doubled whenever entries outnumber buckets
+ */
+#define CACHE_INITIAL_BUCKETS 64
+
+/*
+ * Completion result of a prefix. Entry is published before its result is computed, a
+ * mutation of a word under the prefix removes it, so result computed for a removed entry
+ * is dropped instead of being stored. Stamp tells the computing reader's entry apart from
+ * one inserted again later.
+ */
+typedef struct cache_entry
+{
+    struct cache_entry *next; // in hash bucket
+    struct cache_entry *newer; // in LRU list
+    struct cache_entry *older;
+    uint64_t hash;
+    unsigned long stamp; // generation of the cache when entry was inserted
+    unsigned int refs; // readers streaming the result
+    bool ready; // result is stored
+    bool linked; // reachable from the table, freed on last release otherwise
+    char *text; // words in completion order, each followed by NUL
+    size_t count; // number of words
+    size_t bytes; // accounted against the cache budget
+    size_t prefix_len;
+    char prefix[];
+} cache_entry;
+
+/*
+ * LRU cache of complete results keyed by prefix, bounded by bytes of stored results.
+ * Calls are serialized by its own lock, results are streamed outside of it.
+ */
+typedef struct
+{
+    cache_entry **buckets;
+    size_t bucket_count; // power of two
+    size_t count;
+    cache_entry *newest;
+    cache_entry *oldest;
+    size_t bytes;
+    size_t max_bytes;
+    unsigned long generation; // advanced by every invalidation
+    size_t hits;
+    size_t misses;
+    pthread_mutex_t lock;
+} completion_cache;
+
+completion_cache *create_completion_cache(size_t max_bytes);
+
+void free_completion_cache(completion_cache *c);
+
+cache_entry *cache_acquire(completion_cache *c, const char *prefix, size_t len, unsigned long *stamp);
+
+void cache_release(completion_cache *c, cache_entry *e);
+
+void cache_fill(completion_cache *c, const char *prefix, size_t len, unsigned long stamp,
+		char *text, size_t text_len, size_t count);
+
+void cache_abandon(completion_cache *c, const char *prefix, size_t len, unsigned long stamp);
+
+void cache_invalidate(completion_cache *c, const char *word, size_t len);
+
+void cache_flush(completion_cache *c);
+
+#endif // CACHE_H
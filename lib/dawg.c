@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dawg.h"
+
+/*
+ * Marks state that couldn't be registered
+ */
+#define NO_STATE UINT32_MAX
+
+#define INITIAL_CAPACITY 1024
+
+/*
+ * Growable buffer holding the word being built while frozen graph is traversed
+ */
+typedef struct
+{
+    char *chars;
+    size_t capacity;
+    bool stopped; // completion callback asked to stop
+} word_buffer;
+
+/*
+ * Registry of already built states, equivalent states are looked up by
+ * hash of (eow, outgoing edges) so each one is stored exactly once
+ */
+typedef struct
+{
+    dawg *d;
+    uint32_t state_capacity;
+    uint32_t edge_capacity;
+    uint32_t *table; // state id + 1, 0 marks empty bucket
+    uint32_t table_capacity;
+    dawg_state *states; // writable views of arrays of d
+    dawg_edge *edges;
+    bool failed;
+} dawg_builder;
+
+static uint32_t freeze_node(dawg_builder *b, const node *n);
+static uint32_t register_state(dawg_builder *b, bool eow, const dawg_edge *edges, uint32_t count);
+static uint32_t hash_state(bool eow, const dawg_edge *edges, uint32_t count);
+static bool grow_table(dawg_builder *b);
+static const dawg_edge *state_edges(const dawg *d, uint32_t s);
+static uint32_t find_edge(const dawg *d, uint32_t s, char ch);
+static bool traverse_dawg(const dawg *d, uint32_t s, word_buffer *prefix, size_t prefix_len,
+			  completion_cb cb, void *ctx);
+
+/*
+ * Converts trie into minimal DAWG. Trie is left untouched, so caller decides
+ * whether to keep it (for further mutations) or to reset it.
+ */
+dawg *freeze(const trie *t)
+{
+    dawg *d = calloc(1, sizeof(dawg));
+    if (d == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return NULL;
+    }
+
+    dawg_state *states = malloc(sizeof(dawg_state) * INITIAL_CAPACITY);
+    dawg_edge *edges = malloc(sizeof(dawg_edge) * INITIAL_CAPACITY);
+    d->states = states;
+    d->edges = edges;
+
+    dawg_builder b = {
+	.d = d,
+	.state_capacity = INITIAL_CAPACITY,
+	.edge_capacity = INITIAL_CAPACITY,
+	.table = calloc(INITIAL_CAPACITY * 2, sizeof(uint32_t)),
+	.table_capacity = INITIAL_CAPACITY * 2,
+	.states = states,
+	.edges = edges,
+	.failed = false
+    };
+    if (b.table == NULL || states == NULL || edges == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	free(b.table);
+	free_dawg(d);
+	return NULL;
+    }
+
+    d->root = freeze_node(&b, t->root);
+    d->states = b.states;
+    d->edges = b.edges;
+    free(b.table);
+    if (b.failed) {
+	free_dawg(d);
+	return NULL;
+    }
+    d->size = t->size;
+    return d;
+}
+
+void free_dawg(dawg *d)
+{
+    if (d == NULL) {
+	return;
+    }
+    if (d->mapping != NULL) {
+	munmap(d->mapping, d->mapping_len);
+    } else {
+	free((void *) d->states);
+	free((void *) d->edges);
+    }
+    free(d);
+}
+
+bool dawg_check(const dawg *d, const char *word)
+{
+    if (*word == '\0') {
+	return false;
+    }
+    uint32_t s = d->root;
+    while (*word != '\0' && s != NO_STATE) {
+	s = find_edge(d, s, *word);
+	word++;
+    }
+    return s != NO_STATE && d->states[s].eow;
+}
+
+/*
+ * Passes every word starting with given prefix to cb in alphabetical order
+ */
+void dawg_complete(const dawg *d, const char *word, completion_cb cb, void *ctx)
+{
+    size_t prefix_len = strlen(word);
+    if (prefix_len == 0) {
+	return;
+    }
+    uint32_t s = d->root;
+    for (size_t i = 0; i < prefix_len && s != NO_STATE; i++) {
+	s = find_edge(d, s, word[i]);
+    }
+    if (s == NO_STATE) {
+	return;
+    }
+
+    word_buffer prefix = {
+	.chars = malloc(prefix_len + 1), .capacity = prefix_len + 1, .stopped = false
+    };
+    if (prefix.chars == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return;
+    }
+    memcpy(prefix.chars, word, prefix_len);
+    prefix.chars[prefix_len] = '\0';
+
+    if (!traverse_dawg(d, s, &prefix, prefix_len, cb, ctx)) {
+	fprintf(stderr, "Memory allocation error\n");
+    }
+    free(prefix.chars);
+}
+
+void generate_dawg_txt_file(FILE *fp, const dawg *d)
+{
+    word_buffer prefix = {
+	.chars = malloc(INITIAL_CAPACITY), .capacity = INITIAL_CAPACITY, .stopped = false
+    };
+    if (prefix.chars == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return;
+    }
+    if (!traverse_dawg(d, d->root, &prefix, 0, print_word, fp)) {
+	fprintf(stderr, "Memory allocation error\n");
+    }
+    free(prefix.chars);
+}
+
+/*
+ * Writes header followed by raw state and edge arrays. Offsets inside file
+ * are indices, so the file can be mapped anywhere and queried in place.
+ */
+bool generate_snapshot_file(FILE *fp, const dawg *d)
+{
+    snapshot_header header = {
+	.magic = SNAPSHOT_MAGIC,
+	.version = SNAPSHOT_VERSION,
+	.alphabet = NUMBER_OF_LETTERS,
+	.state_count = d->state_count,
+	.edge_count = d->edge_count,
+	.root = d->root,
+	.size = d->size,
+	.reserved = 0
+    };
+    return fwrite(&header, sizeof(header), 1, fp) == 1 &&
+	fwrite(d->states, sizeof(dawg_state), d->state_count, fp) == d->state_count &&
+	fwrite(d->edges, sizeof(dawg_edge), d->edge_count, fp) == d->edge_count &&
+	fflush(fp) == 0;
+}
+
+/*
+ * Maps snapshot file read-only, only the header is inspected so opening
+ * takes constant time and mapped pages are shared between processes.
+ * States and edges are checked against the arrays as queries reach them.
+ */
+dawg *open_snapshot(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+	fprintf(stderr, "File couldn't be opened\n");
+	return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(snapshot_header)) {
+	fprintf(stderr, "Invalid snapshot file\n");
+	close(fd);
+	return NULL;
+    }
+    size_t len = st.st_size;
+    void *mapping = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+	fprintf(stderr, "Snapshot file couldn't be mapped\n");
+	return NULL;
+    }
+
+    const snapshot_header *header = mapping;
+    size_t expected_len = sizeof(snapshot_header) +
+	sizeof(dawg_state) * (size_t) header->state_count +
+	sizeof(dawg_edge) * (size_t) header->edge_count;
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+	header->alphabet != NUMBER_OF_LETTERS || expected_len != len ||
+	header->root >= header->state_count) {
+	fprintf(stderr, "Invalid snapshot file\n");
+	munmap(mapping, len);
+	return NULL;
+    }
+
+    dawg *d = malloc(sizeof(dawg));
+    if (d == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	munmap(mapping, len);
+	return NULL;
+    }
+    d->states = (const dawg_state *) (header + 1);
+    d->edges = (const dawg_edge *) (d->states + header->state_count);
+    d->state_count = header->state_count;
+    d->edge_count = header->edge_count;
+    d->root = header->root;
+    d->size = header->size;
+    d->mapping = mapping;
+    d->mapping_len = len;
+    return d;
+}
+
+/*
+ * Builds states for label chars of n bottom-up. Returns state reached after the first char
+ * of n's label (or state of n itself for root, which has no label).
+ */
+static uint32_t freeze_node(dawg_builder *b, const node *n)
+{
+    dawg_edge edges[NUMBER_OF_LETTERS];
+    uint32_t count = 0;
+
+    int pos = 0;
+    node *child;
+    while ((child = next_child(n, &pos)) != NULL) {
+	uint32_t target = freeze_node(b, child);
+	if (target == NO_STATE) {
+	    return NO_STATE;
+	}
+	edges[count++] = (dawg_edge) { .target = target, .ch = child->label[0], .reserved = { 0 } };
+    }
+
+    uint32_t s = register_state(b, n->eow, edges, count);
+    for (int i = n->len - 1; i > 0 && s != NO_STATE; i--) {
+	dawg_edge edge = { .target = s, .ch = n->label[i], .reserved = { 0 } };
+	s = register_state(b, false, &edge, 1);
+    }
+    return s;
+}
+
+static uint32_t register_state(dawg_builder *b, bool eow, const dawg_edge *edges, uint32_t count)
+{
+    dawg *d = b->d;
+    uint32_t mask = b->table_capacity - 1;
+    uint32_t bucket = hash_state(eow, edges, count) & mask;
+
+    while (b->table[bucket] != 0) {
+	uint32_t s = b->table[bucket] - 1;
+	const dawg_state *state = &d->states[s];
+	if (state->eow == eow && state->edge_count == count &&
+	    memcmp(d->edges + state->first_edge, edges, sizeof(dawg_edge) * count) == 0) {
+	    return s;
+	}
+	bucket = (bucket + 1) & mask;
+    }
+
+    if (d->state_count == b->state_capacity) {
+	b->state_capacity *= 2;
+	dawg_state *states = realloc(b->states, sizeof(dawg_state) * b->state_capacity);
+	if (states == NULL) {
+	    fprintf(stderr, "Memory allocation error\n");
+	    b->failed = true;
+	    return NO_STATE;
+	}
+	d->states = b->states = states;
+    }
+    while (d->edge_count + count > b->edge_capacity) {
+	b->edge_capacity *= 2;
+	dawg_edge *grown = realloc(b->edges, sizeof(dawg_edge) * b->edge_capacity);
+	if (grown == NULL) {
+	    fprintf(stderr, "Memory allocation error\n");
+	    b->failed = true;
+	    return NO_STATE;
+	}
+	d->edges = b->edges = grown;
+    }
+
+    uint32_t s = d->state_count++;
+    b->states[s] = (dawg_state) {
+	.first_edge = d->edge_count, .edge_count = count, .eow = eow, .reserved = 0
+    };
+    memcpy(b->edges + d->edge_count, edges, sizeof(dawg_edge) * count);
+    d->edge_count += count;
+    b->table[bucket] = s + 1;
+
+    if (d->state_count * 2 > b->table_capacity && !grow_table(b)) {
+	b->failed = true;
+	return NO_STATE;
+    }
+    return s;
+}
+
+/*
+ * FNV-1a over eow flag and (char, target) pairs of outgoing edges
+ */
+static uint32_t hash_state(bool eow, const dawg_edge *edges, uint32_t count)
+{
+    uint32_t h = 2166136261u ^ eow;
+    for (uint32_t i = 0; i < count; i++) {
+	h = (h ^ (unsigned char) edges[i].ch) * 16777619u;
+	h = (h ^ edges[i].target) * 16777619u;
+    }
+    return h;
+}
+
+static bool grow_table(dawg_builder *b)
+{
+    uint32_t capacity = b->table_capacity * 2;
+    uint32_t *table = calloc(capacity, sizeof(uint32_t));
+    if (table == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return false;
+    }
+    const dawg *d = b->d;
+    for (uint32_t s = 0; s < d->state_count; s++) {
+	const dawg_state *state = &d->states[s];
+	uint32_t bucket = hash_state(state->eow, d->edges + state->first_edge, state->edge_count) & (capacity - 1);
+	while (table[bucket] != 0) {
+	    bucket = (bucket + 1) & (capacity - 1);
+	}
+	table[bucket] = s + 1;
+    }
+    free(b->table);
+    b->table = table;
+    b->table_capacity = capacity;
+    return true;
+}
+
+/*
+ * Returns outgoing edges of state s, NULL if s or its edges lie outside the arrays of
+ * a corrupt snapshot
+ */
+static const dawg_edge *state_edges(const dawg *d, uint32_t s)
+{
+    if (s >= d->state_count) {
+	return NULL;
+    }
+    const dawg_state *state = &d->states[s];
+    if ((uint64_t) state->first_edge + state->edge_count > d->edge_count) {
+	return NULL;
+    }
+    return d->edges + state->first_edge;
+}
+
+/*
+ * Binary search over sorted outgoing edges of state s. Freeze registers states bottom-up,
+ * so an edge always leads to an earlier state, other edges of a corrupt snapshot could form
+ * a cycle and are treated as missing.
+ */
+static uint32_t find_edge(const dawg *d, uint32_t s, char ch)
+{
+    int idx = hash(ch);
+    const dawg_edge *edges = state_edges(d, s);
+    if (idx == -1 || edges == NULL) {
+	return NO_STATE;
+    }
+    uint32_t lo = 0, hi = d->states[s].edge_count;
+    while (lo < hi) {
+	uint32_t mid = (lo + hi) / 2;
+	int mid_idx = hash(edges[mid].ch);
+	if (mid_idx == idx) {
+	    return edges[mid].target < s ? edges[mid].target : NO_STATE;
+	}
+	if (mid_idx < idx) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    return NO_STATE;
+}
+
+/*
+ * Passes words of s to cb. States and edges of a corrupt snapshot which find_edge would
+ * reject are skipped, and so are words longer than MAX_WORD_LEN, so recursion stays bounded.
+ */
+static bool traverse_dawg(const dawg *d, uint32_t s, word_buffer *prefix, size_t prefix_len,
+			  completion_cb cb, void *ctx)
+{
+    const dawg_edge *edges = state_edges(d, s);
+    if (edges == NULL) {
+	return true;
+    }
+    if (d->states[s].eow && !cb(prefix->chars, prefix_len, ctx)) {
+	prefix->stopped = true;
+	return true;
+    }
+    if (prefix_len >= MAX_WORD_LEN) {
+	return true;
+    }
+    if (prefix_len + 2 > prefix->capacity) {
+	char *chars = realloc(prefix->chars, prefix->capacity * 2);
+	if (chars == NULL) {
+	    return false;
+	}
+	prefix->chars = chars;
+	prefix->capacity *= 2;
+    }
+    const dawg_state *state = &d->states[s];
+    for (uint32_t i = 0; i < state->edge_count; i++) {
+	const dawg_edge *edge = &edges[i];
+	if (edge->target >= s) {
+	    continue;
+	}
+	prefix->chars[prefix_len] = edge->ch;
+	prefix->chars[prefix_len + 1] = '\0';
+	if (!traverse_dawg(d, edge->target, prefix, prefix_len + 1, cb, ctx)) {
+	    return false;
+	}
+	if (prefix->stopped) {
+	    return true;
+	}
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#ifndef DAWG_H
+#define DAWG_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "trie.h"
+
+/*
+ * Snapshot file identification, "FDAW" in little-endian byte order.
+ * Snapshot written on a machine with different byte order fails magic check.
+ */
+#define SNAPSHOT_MAGIC 0x57414446u
+#define SNAPSHOT_VERSION 1
+
+/*
+ * State of frozen dictionary. Outgoing edges of a state are
+ * edges[first_edge .. first_edge + edge_count), sorted by slot.
+ */
+typedef struct
+{
+    uint32_t first_edge;
+    uint16_t edge_count;
+    uint8_t eow; // end of word
+    uint8_t reserved;
+} dawg_state;
+
+typedef struct
+{
+    uint32_t target;
+    char ch;
+    uint8_t reserved[3];
+} dawg_edge;
+
+/*
+ * Minimal directed acyclic word graph, read-only form of trie where
+ * equivalent subtrees (shared suffixes) are stored once.
+ * States and edges refer to each other by index, never by pointer,
+ * so arrays can be queried in place from a mapped snapshot file.
+ */
+typedef struct
+{
+    const dawg_state *states;
+    const dawg_edge *edges;
+    uint32_t state_count;
+    uint32_t edge_count;
+    uint32_t root;
+    uint32_t size;
+    void *mapping; // snapshot file mapping, NULL if arrays are heap allocated
+    size_t mapping_len;
+} dawg;
+
+/*
+ * Snapshot file layout: header, state array, edge array
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t alphabet; // NUMBER_OF_LETTERS of the writer
+    uint32_t state_count;
+    uint32_t edge_count;
+    uint32_t root;
+    uint32_t size;
+    uint32_t reserved;
+} snapshot_header;
+
+dawg *freeze(const trie *t);
+
+void free_dawg(dawg *d);
+
+bool dawg_check(const dawg *d, const char *word);
+
+void dawg_complete(const dawg *d, const char *word, completion_cb cb, void *ctx);
+
+void generate_dawg_txt_file(FILE *fp, const dawg *d);
+
+bool generate_snapshot_file(FILE *fp, const dawg *d);
+
+dawg *open_snapshot(const char *path);
+
+#endif // DAWG_H
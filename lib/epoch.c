@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "epoch.h"
+
+/*
+ * Initial capacity of retired object list
+ */
+#define RETIRED_LIST_CAPACITY 64
+
+#define ACTIVE_STATE(epoch) (((epoch) << 1) | 1)
+#define STATE_EPOCH(state) ((state) >> 1)
+
+static void free_retired(retired_list *l);
+
+/*
+ * Slot probed first by calling thread, threads keep reusing the slot they got last time
+ */
+static _Thread_local unsigned int slot_hint;
+
+epoch_domain *create_epoch_domain()
+{
+    epoch_domain *d = calloc(1, sizeof(epoch_domain));
+    if (d == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return NULL;
+    }
+    return d;
+}
+
+/*
+ * Releases domain and every retired object, no reader may be active
+ */
+void free_epoch_domain(epoch_domain *d)
+{
+    if (d == NULL) {
+	return;
+    }
+    for (int i = 0; i < 3; i++) {
+	free_retired(&d->limbo[i]);
+	free(d->limbo[i].objs);
+    }
+    free(d);
+}
+
+/*
+ * Starts read-side section, returned slot is passed to epoch_exit.
+ * Objects reachable from shared pointers loaded in the section stay valid until exit.
+ */
+int epoch_enter(epoch_domain *d)
+{
+    unsigned int slot = slot_hint;
+    unsigned long global = __atomic_load_n(&d->global, __ATOMIC_SEQ_CST);
+    for (unsigned int probes = 0; ; probes++) {
+	if (probes > 0 && probes % EPOCH_MAX_READERS == 0) {
+	    sched_yield();
+	}
+	slot = (slot + (probes > 0)) % EPOCH_MAX_READERS;
+	unsigned long expected = 0;
+	if (__atomic_compare_exchange_n(&d->readers[slot].state, &expected, ACTIVE_STATE(global),
+					false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+	    break;
+	}
+    }
+    slot_hint = slot;
+
+    // writer may have advanced the epoch before the slot became visible
+    unsigned long current;
+    while ((current = __atomic_load_n(&d->global, __ATOMIC_SEQ_CST)) != global) {
+	global = current;
+	__atomic_store_n(&d->readers[slot].state, ACTIVE_STATE(global), __ATOMIC_SEQ_CST);
+    }
+    return slot;
+}
+
+void epoch_exit(epoch_domain *d, int slot)
+{
+    __atomic_store_n(&d->readers[slot].state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Defers release of object unlinked in the current epoch. If it can't be recorded,
+ * object is leaked rather than freed under a reader.
+ */
+bool epoch_retire(epoch_domain *d, pool *owner, void *obj)
+{
+    retired_list *l = &d->limbo[d->global % 3];
+    if (l->count == l->capacity) {
+	size_t capacity = l->capacity > 0 ? l->capacity * 2 : RETIRED_LIST_CAPACITY;
+	retired_obj *objs = realloc(l->objs, sizeof(retired_obj) * capacity);
+	if (objs == NULL) {
+	    fprintf(stderr, "Memory allocation error\n");
+	    return false;
+	}
+	l->objs = objs;
+	l->capacity = capacity;
+    }
+    l->objs[l->count++] = (retired_obj) { .owner = owner, .obj = obj };
+    return true;
+}
+
+/*
+ * Advances global epoch if every active reader is in it, then frees objects
+ * retired two epochs ago, which no reader can reach anymore
+ */
+void epoch_collect(epoch_domain *d)
+{
+    unsigned long global = d->global;
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+	unsigned long state = __atomic_load_n(&d->readers[i].state, __ATOMIC_SEQ_CST);
+	if (state != 0 && STATE_EPOCH(state) != global) {
+	    return;
+	}
+    }
+    __atomic_store_n(&d->global, global + 1, __ATOMIC_SEQ_CST);
+    free_retired(&d->limbo[(global + 2) % 3]);
+}
+
+/*
+ * Drops retired objects without freeing them, used when their pools were reset
+ */
+void epoch_forget(epoch_domain *d)
+{
+    for (int i = 0; i < 3; i++) {
+	d->limbo[i].count = 0;
+    }
+}
+
+static void free_retired(retired_list *l)
+{
+    for (size_t i = 0; i < l->count; i++) {
+	pool_free(l->objs[i].owner, l->objs[i].obj);
+    }
+    l->count = 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdbool.h>
+#include "pool.h"
+
+/*
+ * Number of threads which can be inside read-side sections at the same time
+ */
+#define EPOCH_MAX_READERS 128
+
+/*
+ * Reader slots are padded to separate cache lines, so readers don't contend on enter/exit
+ */
+#define EPOCH_SLOT_SIZE 64
+
+/*
+ * Object unlinked by writer, returned to its pool once no reader can reach it
+ */
+typedef struct
+{
+    pool *owner;
+    void *obj;
+} retired_obj;
+
+typedef struct
+{
+    retired_obj *objs;
+    size_t count;
+    size_t capacity;
+} retired_list;
+
+/*
+ * Reader slot state, 0 if slot is free, otherwise epoch of reader shifted left by one with low bit set
+ */
+typedef struct
+{
+    unsigned long state;
+    char pad[EPOCH_SLOT_SIZE - sizeof(unsigned long)];
+} epoch_slot;
+
+/*
+ * Epoch-based reclamation for a single writer and lock-free readers.
+ * Object retired in epoch e is freed once global epoch reaches e + 2, global epoch
+ * advances only when every active reader has observed the current one.
+ * Retire and collect must be serialized by the writer.
+ */
+typedef struct
+{
+    unsigned long global;
+    epoch_slot readers[EPOCH_MAX_READERS];
+    retired_list limbo[3]; // retired objects indexed by epoch modulo 3
+} epoch_domain;
+
+epoch_domain *create_epoch_domain();
+
+void free_epoch_domain(epoch_domain *d);
+
+int epoch_enter(epoch_domain *d);
+
+void epoch_exit(epoch_domain *d, int slot);
+
+bool epoch_retire(epoch_domain *d, pool *owner, void *obj);
+
+void epoch_collect(epoch_domain *d);
+
+void epoch_forget(epoch_domain *d);
+
+#endif // EPOCH_H
@@ -9,8 +9,20 @@
 #define DOT_GRAPH_FORMAT_FLAG "-Tsvg"
 #define FILE_EXTENSION_LEN 5
 
-#define DOT_FILE_ROOT_NODE_FORMAT "  \"%p\" [label=\"%c\";fillcolor=%s;style=filled;fontcolor=white]\n"
-#define DOT_FILE_CHILD_NODE_FORMAT "  \"%p\" [label=\"%c\";fillcolor=%s;style=filled;fontcolor=white]\n"
+/*
+ * Number of dot processes reaped asynchronously, visualizing waits for dot beyond them
+ */
+#define MAX_PENDING_RENDERERS 16
+
+/*
+ * Nodes are named n<pre-order number>, hidden node stands for the words below its parent.
+ * Label of a drawn node is written with quotes and backslashes escaped between its name
+ * and its style.
+ */
+#define DOT_FILE_NODE_NAME_FORMAT "  n%zu [label=\""
+#define DOT_FILE_NODE_STYLE_FORMAT "\";fillcolor=%s;style=filled;fontcolor=white]\n"
+#define DOT_FILE_HIDDEN_NODE_FORMAT "  n%zu [label=\"%u words\";style=dashed]\n"
+#define DOT_FILE_EDGE_FORMAT "  n%zu -> n%zu\n"
 
 #define ROOT_NODE_COLOR "red"
 #define CHILD_NODE_COLOR "black"
@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "alphabet.h"
+
+#define FNV32_OFFSET 2166136261u
+#define FNV32_PRIME 16777619u
+
+/*
+ * Kind, word length and checksum, score follows length in scored records
+ */
+#define RECORD_HEADER_LEN (1 + sizeof(uint16_t) + sizeof(uint32_t))
+
+#define REWRITE_SUFFIX ".tmp"
+
+static bool replay(journal *j, int fd, size_t size, journal_cb cb, void *ctx);
+static size_t decode_record(const char *data, size_t len, enum JOURNAL_RECORD *kind, const char **word,
+			    size_t *word_len, unsigned int *score);
+static bool encode_record(journal_buffer *b, enum JOURNAL_RECORD kind, const char *word, size_t len,
+			  unsigned int score);
+static uint32_t checksum(const char *head, size_t head_len, const char *word, size_t len);
+static bool reserve(journal_buffer *b, size_t len);
+static bool write_all(int fd, const char *data, size_t len);
+static bool sync_parent(const char *path);
+static int rewrite(journal *j, const journal_buffer *snapshot, const char *tail, size_t tail_len);
+static void *flush_loop(void *arg);
+
+/*
+ * Opens journal file, creating it if missing, and passes every record to cb in order.
+ * Torn record left at the end by a crash and anything after it is cut off the file.
+ */
+journal *open_journal(const char *path, journal_cb cb, void *ctx)
+{
+    journal *j = calloc(1, sizeof(journal));
+    if (j == NULL || (j->path = strdup(path)) == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	free(j);
+	return NULL;
+    }
+    j->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat st;
+    if (j->fd == -1 || fstat(j->fd, &st) == -1) {
+	fprintf(stderr, "Journal couldn't be opened\n");
+	goto fail;
+    }
+    if (st.st_size == 0) {
+	journal_header header = {
+	    .magic = JOURNAL_MAGIC, .version = JOURNAL_VERSION, .alphabet = NUMBER_OF_LETTERS, .reserved = 0
+	};
+	if (!write_all(j->fd, (const char *) &header, sizeof(header)) || fsync(j->fd) == -1) {
+	    fprintf(stderr, "Journal couldn't be written\n");
+	    goto fail;
+	}
+	j->bytes = sizeof(header);
+    } else if (!replay(j, j->fd, st.st_size, cb, ctx)) {
+	goto fail;
+    }
+    j->compacted_bytes = j->bytes;
+
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->wake, NULL);
+    pthread_cond_init(&j->done, NULL);
+    if (pthread_create(&j->flusher, NULL, flush_loop, j) != 0) {
+	fprintf(stderr, "Journal flusher couldn't be started\n");
+	pthread_cond_destroy(&j->done);
+	pthread_cond_destroy(&j->wake);
+	pthread_mutex_destroy(&j->lock);
+	goto fail;
+    }
+    return j;
+
+fail:
+    if (j->fd != -1) {
+	close(j->fd);
+    }
+    free(j->path);
+    free(j);
+    return NULL;
+}
+
+/*
+ * Waits until every appended record is on disk and releases journal
+ */
+void close_journal(journal *j)
+{
+    if (j == NULL) {
+	return;
+    }
+    journal_sync(j);
+    pthread_mutex_lock(&j->lock);
+    j->stop = true;
+    pthread_cond_signal(&j->wake);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->flusher, NULL);
+
+    close(j->fd);
+    pthread_cond_destroy(&j->done);
+    pthread_cond_destroy(&j->wake);
+    pthread_mutex_destroy(&j->lock);
+    free(j->pending.data);
+    free(j->spare.data);
+    free(j->rewrite.data);
+    free(j->path);
+    free(j);
+}
+
+/*
+ * Encodes record into memory, it reaches disk with the next batch of the flusher.
+ * Returns false if record can't be made durable.
+ */
+bool journal_append(journal *j, enum JOURNAL_RECORD kind, const char *word, size_t len, unsigned int score)
+{
+    pthread_mutex_lock(&j->lock);
+    size_t pending_len = j->pending.len;
+    bool ok = !j->failed && encode_record(&j->pending, kind, word, len, score);
+    if (ok) {
+	j->bytes += j->pending.len - pending_len;
+	j->appended++;
+	if (pending_len == 0) {
+	    pthread_cond_signal(&j->wake);
+	}
+    }
+    pthread_mutex_unlock(&j->lock);
+    return ok;
+}
+
+/*
+ * Waits until every record appended so far is on disk, batch is flushed right away
+ */
+bool journal_sync(journal *j)
+{
+    pthread_mutex_lock(&j->lock);
+    unsigned long target = j->appended;
+    if (j->synced < target) {
+	j->sync_requested = true;
+	pthread_cond_signal(&j->wake);
+    }
+    while (j->synced < target && !j->failed) {
+	pthread_cond_wait(&j->done, &j->lock);
+    }
+    bool ok = !j->failed;
+    pthread_mutex_unlock(&j->lock);
+    return ok;
+}
+
+/*
+ * Journal which doubled since it was last compacted takes longer to replay than
+ * a snapshot of the words it leads to
+ */
+bool journal_needs_compaction(journal *j)
+{
+    pthread_mutex_lock(&j->lock);
+    bool needed = !j->failed && !j->rewriting && j->bytes > JOURNAL_COMPACT_MIN_BYTES
+	&& j->bytes > 2 * j->compacted_bytes;
+    pthread_mutex_unlock(&j->lock);
+    return needed;
+}
+
+/*
+ * Starts snapshot of current words in memory. Caller appends their records and no other
+ * record may be appended until journal_rewrite_end.
+ */
+bool journal_rewrite_begin(journal *j)
+{
+    pthread_mutex_lock(&j->lock);
+    bool ok = !j->failed && !j->rewriting;
+    pthread_mutex_unlock(&j->lock);
+    j->rewrite.len = 0;
+    return ok;
+}
+
+bool journal_rewrite_append(journal *j, enum JOURNAL_RECORD kind, const char *word, size_t len,
+			    unsigned int score)
+{
+    return encode_record(&j->rewrite, kind, word, len, score);
+}
+
+/*
+ * Hands snapshot over to the flusher, which writes it followed by records appended after
+ * it into a new file in the background, or drops it
+ */
+bool journal_rewrite_end(journal *j, bool commit)
+{
+    pthread_mutex_lock(&j->lock);
+    if (commit) {
+	j->snapshot = j->rewrite;
+	j->rewrite = (journal_buffer) { 0 };
+	j->snapshot_offset = j->pending.len;
+	j->rewriting = true;
+	pthread_cond_signal(&j->wake);
+    } else {
+	free(j->rewrite.data);
+	j->rewrite = (journal_buffer) { 0 };
+	j->compacted_bytes = j->bytes; // next attempt once journal doubles again
+    }
+    pthread_mutex_unlock(&j->lock);
+    return commit;
+}
+
+/*
+ * Waits until the new file of the last snapshot is in place, returns false if it was dropped
+ */
+bool journal_rewrite_wait(journal *j)
+{
+    pthread_mutex_lock(&j->lock);
+    while (j->rewriting) {
+	pthread_cond_wait(&j->done, &j->lock);
+    }
+    bool ok = j->rewritten;
+    pthread_mutex_unlock(&j->lock);
+    return ok;
+}
+
+/*
+ * Reads whole file and passes its records to cb, file is cut after the last valid record
+ */
+static bool replay(journal *j, int fd, size_t size, journal_cb cb, void *ctx)
+{
+    // NUL after the last record ends its word, like kind byte of the next record does
+    char *data = malloc(size + 1);
+    if (data == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return false;
+    }
+    size_t read_len = 0;
+    ssize_t n;
+    while (read_len < size && (n = pread(fd, data + read_len, size - read_len, read_len)) > 0) {
+	read_len += n;
+    }
+    data[read_len] = '\0';
+
+    const journal_header *header = (const journal_header *) data;
+    if (read_len != size || size < sizeof(journal_header) || header->magic != JOURNAL_MAGIC ||
+	header->version != JOURNAL_VERSION || header->alphabet != NUMBER_OF_LETTERS) {
+	fprintf(stderr, "Invalid journal file\n");
+	free(data);
+	return false;
+    }
+
+    // valid records are found first, so the torn tail doesn't follow the last word
+    enum JOURNAL_RECORD kind;
+    const char *word;
+    size_t len;
+    unsigned int score;
+    size_t end = sizeof(journal_header);
+    size_t record_len;
+    while ((record_len = decode_record(data + end, size - end, &kind, &word, &len, &score)) > 0) {
+	end += record_len;
+    }
+    data[end] = '\0';
+
+    size_t offset = sizeof(journal_header);
+    bool ok = true;
+    while (ok && offset < end) {
+	offset += decode_record(data + offset, end - offset, &kind, &word, &len, &score);
+	ok = cb(kind, word, len, score, ctx);
+    }
+    ok = ok && cb(JOURNAL_END, data + end, 0, 0, ctx);
+    free(data);
+    if (ok && end < size) {
+	fprintf(stderr, "Journal record at offset %zu is torn, %zu bytes dropped\n", end, size - end);
+	ok = ftruncate(fd, end) == 0 && fsync(fd) == 0;
+    }
+    j->bytes = end;
+    return ok;
+}
+
+/*
+ * Returns length of record at data, 0 if it is incomplete or its checksum doesn't match
+ */
+static size_t decode_record(const char *data, size_t len, enum JOURNAL_RECORD *kind, const char **word,
+			    size_t *word_len, unsigned int *score)
+{
+    if (len < RECORD_HEADER_LEN) {
+	return 0;
+    }
+    *kind = (unsigned char) data[0];
+    if (*kind < JOURNAL_PUT || *kind > JOURNAL_RESET) {
+	return 0;
+    }
+    uint16_t wlen;
+    memcpy(&wlen, data + 1, sizeof(wlen));
+    size_t head_len = 1 + sizeof(wlen);
+    uint32_t value = 0;
+    if (*kind == JOURNAL_PUT_SCORED) {
+	if (len < RECORD_HEADER_LEN + sizeof(value)) {
+	    return 0;
+	}
+	memcpy(&value, data + head_len, sizeof(value));
+	head_len += sizeof(value);
+    }
+    size_t record_len = head_len + sizeof(uint32_t) + wlen;
+    if (record_len > len) {
+	return 0;
+    }
+    uint32_t sum;
+    memcpy(&sum, data + head_len, sizeof(sum));
+    *word = data + head_len + sizeof(sum);
+    if (sum != checksum(data, head_len, *word, wlen)) {
+	return 0;
+    }
+    *word_len = wlen;
+    *score = value;
+    return record_len;
+}
+
+static bool encode_record(journal_buffer *b, enum JOURNAL_RECORD kind, const char *word, size_t len,
+			  unsigned int score)
+{
+    if (len > UINT16_MAX) {
+	return false;
+    }
+    uint16_t wlen = len;
+    uint32_t value = score;
+    char head[1 + sizeof(wlen) + sizeof(value)];
+    size_t head_len = 1 + sizeof(wlen);
+    head[0] = kind;
+    memcpy(head + 1, &wlen, sizeof(wlen));
+    if (kind == JOURNAL_PUT_SCORED) {
+	memcpy(head + head_len, &value, sizeof(value));
+	head_len += sizeof(value);
+    }
+    uint32_t sum = checksum(head, head_len, word, len);
+    if (!reserve(b, head_len + sizeof(sum) + len)) {
+	return false;
+    }
+    char *p = b->data + b->len;
+    memcpy(p, head, head_len);
+    memcpy(p + head_len, &sum, sizeof(sum));
+    memcpy(p + head_len + sizeof(sum), word, len);
+    b->len += head_len + sizeof(sum) + len;
+    return true;
+}
+
+/*
+ * FNV-1a over record head and word
+ */
+static uint32_t checksum(const char *head, size_t head_len, const char *word, size_t len)
+{
+    uint32_t h = FNV32_OFFSET;
+    for (size_t i = 0; i < head_len; i++) {
+	h = (h ^ (unsigned char) head[i]) * FNV32_PRIME;
+    }
+    for (size_t i = 0; i < len; i++) {
+	h = (h ^ (unsigned char) word[i]) * FNV32_PRIME;
+    }
+    return h;
+}
+
+/*
+ * Grows buffer to fit len more bytes
+ */
+static bool reserve(journal_buffer *b, size_t len)
+{
+    if (b->len + len <= b->capacity) {
+	return true;
+    }
+    size_t capacity = b->capacity > 0 ? b->capacity : JOURNAL_BUFFER_SIZE;
+    while (capacity < b->len + len) {
+	capacity *= 2;
+    }
+    char *data = realloc(b->data, capacity);
+    if (data == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return false;
+    }
+    b->data = data;
+    b->capacity = capacity;
+    return true;
+}
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+	ssize_t n = write(fd, data, len);
+	if (n == -1 && errno == EINTR) {
+	    continue;
+	}
+	if (n <= 0) {
+	    return false;
+	}
+	data += n;
+	len -= n;
+    }
+    return true;
+}
+
+/*
+ * Makes rename of a file in the directory durable
+ */
+static bool sync_parent(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char dir[slash != NULL ? slash - path + 2 : 2];
+    if (slash == NULL) {
+	strcpy(dir, ".");
+    } else {
+	memcpy(dir, path, slash - path + 1);
+	dir[slash - path + 1] = '\0';
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+	return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/*
+ * Writes snapshot followed by tail into a file next to journal and renames it over journal
+ * once it is on disk. Returns descriptor of the new journal, -1 if the old one is kept.
+ * Crash at any point leaves either the old or the new journal in place.
+ */
+static int rewrite(journal *j, const journal_buffer *snapshot, const char *tail, size_t tail_len)
+{
+    char tmp_path[strlen(j->path) + sizeof(REWRITE_SUFFIX)];
+    strcpy(tmp_path, j->path);
+    strcat(tmp_path, REWRITE_SUFFIX);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    journal_header header = {
+	.magic = JOURNAL_MAGIC, .version = JOURNAL_VERSION, .alphabet = NUMBER_OF_LETTERS, .reserved = 0
+    };
+    if (fd == -1 || !write_all(fd, (const char *) &header, sizeof(header))
+	|| !write_all(fd, snapshot->data, snapshot->len) || !write_all(fd, tail, tail_len)
+	|| fsync(fd) == -1 || rename(tmp_path, j->path) == -1) {
+	fprintf(stderr, "Journal couldn't be compacted\n");
+	if (fd != -1) {
+	    close(fd);
+	    unlink(tmp_path);
+	}
+	return -1;
+    }
+    sync_parent(j->path);
+    return fd;
+}
+
+/*
+ * Group commit: waits for the first pending record, lets records pile up for the sync
+ * interval unless a thread waits for them, then writes the batch and fsyncs it at once.
+ * Appenders keep filling the other buffer meanwhile. Snapshot of compaction is written
+ * the same way, records appended after it follow it in the new file.
+ */
+static void *flush_loop(void *arg)
+{
+    journal *j = arg;
+    pthread_mutex_lock(&j->lock);
+    while (true) {
+	while (j->pending.len == 0 && !j->rewriting && !j->stop) {
+	    pthread_cond_wait(&j->wake, &j->lock);
+	}
+	if (j->pending.len == 0 && !j->rewriting) {
+	    break;
+	}
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += JOURNAL_SYNC_INTERVAL_MS * 1000000L;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+	deadline.tv_nsec %= 1000000000L;
+	while (!j->stop && !j->sync_requested
+	       && pthread_cond_timedwait(&j->wake, &j->lock, &deadline) != ETIMEDOUT) {
+	}
+
+	journal_buffer batch = j->pending;
+	j->pending = j->spare;
+	unsigned long upto = j->appended;
+	int fd = j->fd;
+	bool rewriting = j->rewriting;
+	journal_buffer snapshot = j->snapshot;
+	size_t offset = j->snapshot_offset;
+	pthread_mutex_unlock(&j->lock);
+	// records before the snapshot are in it, they reach the old file only if it is kept
+	const char *tail = batch.len > offset ? batch.data + offset : NULL;
+	int new_fd = rewriting ? rewrite(j, &snapshot, tail, batch.len - offset) : -1;
+	bool ok = new_fd != -1 || (write_all(fd, batch.data, batch.len) && fdatasync(fd) == 0);
+	free(snapshot.data);
+	pthread_mutex_lock(&j->lock);
+
+	if (rewriting) {
+	    if (new_fd != -1) {
+		close(j->fd);
+		j->fd = new_fd;
+		j->compacted_bytes = sizeof(journal_header) + snapshot.len + batch.len - offset;
+		j->bytes = j->compacted_bytes + j->pending.len;
+	    } else {
+		j->compacted_bytes = j->bytes; // next attempt once journal doubles again
+	    }
+	    j->snapshot = (journal_buffer) { 0 };
+	    j->rewriting = false;
+	    j->rewritten = new_fd != -1;
+	}
+	batch.len = 0;
+	j->spare = batch;
+	if (ok) {
+	    j->synced = upto;
+	} else if (!j->failed) {
+	    j->failed = true;
+	    fprintf(stderr, "Journal couldn't be written, further mutations are not durable\n");
+	}
+	if (j->synced == j->appended) {
+	    j->sync_requested = false;
+	}
+	pthread_cond_broadcast(&j->done);
+    }
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
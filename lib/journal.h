@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define JOURNAL_MAGIC 0x4A4D4346 // "FCMJ"
+#define JOURNAL_VERSION 1
+
+/*
+ * Records appended within this many milliseconds share a single fsync
+ */
+#define JOURNAL_SYNC_INTERVAL_MS 10
+
+/*
+ * Initial capacity of record buffers
+ */
+#define JOURNAL_BUFFER_SIZE (1 << 16)
+
+/*
+ * Journal is compacted once it outgrows this size and twice its size after the last compaction
+ */
+#define JOURNAL_COMPACT_MIN_BYTES (1 << 20)
+
+/*
+ * Record kinds. Replaying records in order over the state they were appended to, or over
+ * any later state of the same journal, leads to the same words and scores.
+ */
+enum JOURNAL_RECORD {
+    /* Passed to replay callback after the last record, never stored */
+    JOURNAL_END,
+    /* Adds word, score of existing word is kept */
+    JOURNAL_PUT,
+    /* Adds word or overwrites its score */
+    JOURNAL_PUT_SCORED,
+    /* Deletes word */
+    JOURNAL_DELETE,
+    /* Removes every word */
+    JOURNAL_RESET
+};
+
+/*
+ * File layout: header followed by records. Record is kind byte, word length (2 bytes),
+ * score (4 bytes, JOURNAL_PUT_SCORED only), checksum (4 bytes) and word. Checksum covers
+ * the rest of the record, so a torn record at the end of file left by a crash is detected.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t alphabet; // NUMBER_OF_LETTERS of the writer
+    uint32_t reserved;
+} journal_header;
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t capacity;
+} journal_buffer;
+
+/*
+ * Append-only log of mutations. Records are encoded into memory by the mutating thread,
+ * a flusher thread writes them and fsyncs the file once per batch (group commit).
+ */
+typedef struct
+{
+    int fd;
+    char *path;
+    journal_buffer pending; // appended, not written yet
+    journal_buffer spare; // swapped with pending by the flusher, written outside the lock
+    size_t bytes; // file size with pending records included
+    size_t compacted_bytes; // file size after the last compaction or replay
+    unsigned long appended; // number of records appended since open
+    unsigned long synced; // number of records known to be on disk
+    bool sync_requested; // a thread waits for every appended record to be on disk
+    bool failed; // write or fsync failed, records are not durable anymore
+    bool stop;
+    journal_buffer rewrite; // records of current words encoded by the mutating thread
+    journal_buffer snapshot; // rewrite handed over to the flusher, written into a new file
+    size_t snapshot_offset; // length of pending when snapshot was taken, the rest follows it
+    bool rewriting; // snapshot is taken and the new file isn't in place yet
+    bool rewritten; // outcome of the last compaction
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // signals flusher
+    pthread_cond_t done; // signals threads waiting in journal_sync
+} journal;
+
+/*
+ * Receives replayed record, word (not NUL-terminated) stays valid until JOURNAL_END is passed
+ * and is followed by a char which is not in the alphabet. Returning false stops replay.
+ */
+typedef bool (*journal_cb)(enum JOURNAL_RECORD kind, const char *word, size_t len,
+			   unsigned int score, void *ctx);
+
+journal *open_journal(const char *path, journal_cb cb, void *ctx);
+
+void close_journal(journal *j);
+
+bool journal_append(journal *j, enum JOURNAL_RECORD kind, const char *word, size_t len, unsigned int score);
+
+bool journal_sync(journal *j);
+
+bool journal_needs_compaction(journal *j);
+
+bool journal_rewrite_begin(journal *j);
+
+bool journal_rewrite_append(journal *j, enum JOURNAL_RECORD kind, const char *word, size_t len,
+			    unsigned int score);
+
+bool journal_rewrite_end(journal *j, bool commit);
+
+bool journal_rewrite_wait(journal *j);
+
+#endif // JOURNAL_H
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+/*
+ * Rounds object size up to pointer alignment (free list links are stored inside released objects)
+ */
+#define ALIGN_OBJECT_SIZE(size) \
+    (((size) + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *))
+
+static bool pool_grow(pool *p);
+
+void pool_init(pool *p, size_t object_size)
+{
+    p->object_size = ALIGN_OBJECT_SIZE(object_size < sizeof(void *) ? sizeof(void *) : object_size);
+    p->chunks = NULL;
+    p->cursor = NULL;
+    p->limit = NULL;
+    p->free_list = NULL;
+    p->chunk_count = 0;
+}
+
+void *pool_alloc(pool *p)
+{
+    void *obj;
+    if (p->free_list != NULL) {
+	obj = p->free_list;
+	p->free_list = *(void **) obj;
+    } else {
+	if (p->cursor == p->limit && !pool_grow(p)) {
+	    return NULL;
+	}
+	obj = p->cursor;
+	p->cursor += p->object_size;
+    }
+    memset(obj, 0, p->object_size);
+    return obj;
+}
+
+void pool_free(pool *p, void *obj)
+{
+    if (obj == NULL) {
+	return;
+    }
+    *(void **) obj = p->free_list;
+    p->free_list = obj;
+}
+
+/*
+ * Releases every slab at once, objects allocated from pool become invalid
+ */
+void pool_reset(pool *p)
+{
+    chunk *c = p->chunks;
+    while (c != NULL) {
+	chunk *next = c->next;
+	free(c);
+	c = next;
+    }
+    p->chunks = NULL;
+    p->cursor = NULL;
+    p->limit = NULL;
+    p->free_list = NULL;
+    p->chunk_count = 0;
+}
+
+/*
+ * Moves slabs of src into dst, objects of src stay valid and are owned by dst afterwards.
+ * Both pools must serve objects of the same size, src is left empty.
+ */
+void pool_adopt(pool *dst, pool *src)
+{
+    // unused tail of the current slab of src is reused through the free list
+    while (src->cursor != src->limit) {
+	pool_free(src, src->cursor);
+	src->cursor += src->object_size;
+    }
+
+    if (src->chunks != NULL) {
+	chunk *last = src->chunks;
+	while (last->next != NULL) {
+	    last = last->next;
+	}
+	last->next = dst->chunks;
+	dst->chunks = src->chunks;
+	dst->chunk_count += src->chunk_count;
+    }
+
+    if (src->free_list != NULL) {
+	void **last = src->free_list;
+	while (*last != NULL) {
+	    last = *last;
+	}
+	*last = dst->free_list;
+	dst->free_list = src->free_list;
+    }
+
+    pool_init(src, src->object_size);
+}
+
+/*
+ * Bytes taken by slabs of the pool, released and not yet carved objects included
+ */
+size_t pool_reserved_bytes(const pool *p)
+{
+    return p->chunk_count * (ALIGN_OBJECT_SIZE(sizeof(chunk)) + p->object_size * POOL_CHUNK_OBJECTS);
+}
+
+void pool_destroy(pool *p)
+{
+    pool_reset(p);
+}
+
+static bool pool_grow(pool *p)
+{
+    size_t header = ALIGN_OBJECT_SIZE(sizeof(chunk));
+    chunk *c = malloc(header + p->object_size * POOL_CHUNK_OBJECTS);
+    if (c == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return false;
+    }
+    c->next = p->chunks;
+    p->chunks = c;
+    p->cursor = (char *) c + header;
+    p->limit = p->cursor + p->object_size * POOL_CHUNK_OBJECTS;
+    p->chunk_count++;
+    return true;
+}
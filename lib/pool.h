@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * Number of objects carved out of a single slab
+ */
+#define POOL_CHUNK_OBJECTS 1024
+
+/*
+ * Slab header, objects of the slab follow it in memory
+ */
+typedef struct chunk
+{
+    struct chunk *next;
+} chunk;
+
+/*
+ * Fixed-size object allocator. Objects are bump allocated from chunked slabs,
+ * released objects are kept in a free list and reused by later allocations.
+ */
+typedef struct
+{
+    size_t object_size;
+    chunk *chunks;
+    char *cursor;
+    char *limit;
+    void *free_list;
+    size_t chunk_count;
+} pool;
+
+void pool_init(pool *p, size_t object_size);
+
+void *pool_alloc(pool *p);
+
+void pool_free(pool *p, void *obj);
+
+void pool_reset(pool *p);
+
+void pool_adopt(pool *dst, pool *src);
+
+size_t pool_reserved_bytes(const pool *p);
+
+void pool_destroy(pool *p);
+
+#endif // POOL_H
@@ -2,54 +2,251 @@
  * Copyright (c) 2023, Farhad Mehdizada
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include "trie.h"
 #include "graphviz_cfg.h"
 
-#define IS_CPTL_LTR(ch) ((ch) >= 65 && (ch) <= 90)
-#define IS_LWR_LTR(ch) ((ch) >= 97 && (ch) <= 122)
-#define IS_VALID_CHAR(ch) (IS_CPTL_LTR(ch) || IS_LWR_LTR(ch))
+/*
+ * Label drawn for root of trie
+ */
+#define ROOT_LABEL "."
+
+/*
+ * Declares cursor c for walking trie t, with stack and prefix buffer in automatic storage
+ */
+#define DECLARE_WALK(c, t)						\
+    cursor_frame c##_stack[WALK_CAPACITY(t)];				\
+    char c##_prefix[WALK_CAPACITY(t)];					\
+    completion_cursor c = {						\
+	.stack = c##_stack, .stack_len = 0, .stack_capacity = WALK_CAPACITY(t),	\
+	.prefix = c##_prefix, .prefix_capacity = WALK_CAPACITY(t), .pending = false \
+    }
+
+/*
+ * Child pointers, root and word fields of published nodes. In concurrent mode readers load
+ * them without locks while the writer stores them, everything else in a published node is
+ * immutable and changed only through a copy (see writable_node).
+ */
+#define LOAD_SHARED(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE_SHARED(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/*
+ * Capacity of traversal buffers, in concurrent mode longer words may appear during a walk
+ */
+#define WALK_CAPACITY(t) ((t)->epoch != NULL ? MAX_WORD_LEN + 1 : (t)->max_len + 1)
+
+/*
+ * State of a single insertion threaded through put_node
+ */
+typedef struct
+{
+    unsigned int score;
+    bool scored; // score of already existing word is overwritten
+    bool added; // word wasn't in trie before
+    bool lowered; // score of existing word decreased, best scores on path are recomputed
+} insertion;
+
+/*
+ * Entry of best-first search in complete_topk, either a node whose subtree is not
+ * expanded yet or a word ready to be emitted. Text is stored in shared char buffer.
+ */
+typedef struct
+{
+    unsigned int priority;
+    bool is_word;
+    const node *n;
+    size_t text; // offset of text in buffer
+    size_t text_len;
+} topk_entry;
+
+typedef struct
+{
+    topk_entry *entries;
+    size_t count;
+    size_t capacity;
+    char *text;
+    size_t text_len;
+    size_t text_capacity;
+} topk_heap;
+
+/*
+ * Validated word with slot of every char, descent indexes children by slots
+ * instead of hashing chars again
+ */
+typedef struct
+{
+    const char *chars; // followed by a char which is not in the alphabet
+    size_t len;
+    unsigned char slots[MAX_WORD_LEN];
+} mapped_word;
+
+/*
+ * Copy of words of complete, stored in completion cache once the walk ends. Only results
+ * consumed in full are stored, walk stops as soon as cb stops it.
+ */
+typedef struct
+{
+    completion_cb cb;
+    void *ctx;
+    char *text;
+    size_t len;
+    size_t capacity;
+    size_t count;
+    size_t limit;
+    bool ok;
+} word_recorder;
+
+/*
+ * Consecutive put records of journal replay, loaded at once like a sorted file
+ */
+typedef struct
+{
+    trie *t;
+    bulk_word *words;
+    size_t count;
+    size_t capacity;
+} replay_batch;
+
+/*
+ * Parallel load shared by workers. Subtrees under root are independent, so words are
+ * partitioned by their first char and each shard is built by a single worker.
+ */
+typedef struct
+{
+    const trie *t;
+    const bulk_word *words;
+    const size_t *order; // word indices grouped by shard, input order is kept inside shard
+    size_t shard_start[NUMBER_OF_LETTERS + 1]; // shard s is order[shard_start[s] .. shard_start[s + 1])
+    int owner[NUMBER_OF_LETTERS]; // worker which built the shard
+    atomic_int next_shard;
+} load_job;
+
+typedef struct
+{
+    load_job *job;
+    trie *local; // private trie of worker, its root holds built shards only
+    int id;
+} load_worker;
 
 /*
- * Character dot (.) is allocated for root of trie
+ * Node on the path of previously inserted word in sorted load
  */
-#define ROOT_CHAR '.'
+typedef struct
+{
+    node *n;
+    size_t depth; // prefix length before label of n
+} path_frame;
 
 /*
- * Expands prefix by 1 letter in each step of trie traverse
+ * Word found by suggest, word buffer is owned by the entry and reused on replacement
  */
-#define EXPAND_PREFIX(prefix, prefix_len, ch)		\
-    prefix = realloc(prefix, (prefix_len) + 1);		\
-    if (prefix == NULL) {				\
-	fprintf(stderr, "Memory allocation error\n");	\
-	return NULL;					\
-    }							\
-    prefix[(prefix_len) - 1] = ch;			\
-    prefix[prefix_len] = '\0';				\
+typedef struct
+{
+    unsigned int distance;
+    unsigned int score;
+    char *word;
+    size_t len;
+} suggestion;
 
 /*
- * Enum for separating different types of nodes in deletion process (eow node, leaf node, orphan node)
+ * Depth-first walk of suggest. Row d of rows holds edit distances between the first d chars
+ * of the current path and every prefix of the searched word.
  */
-enum NODE_TYPE {
-    EOW_NODE, LEAF_NODE, ORPHAN_NODE
-};
+typedef struct
+{
+    const char *word;
+    const unsigned char *slots; // slot of every char of word
+    size_t word_len;
+    unsigned int max_edits; // bound until k words are kept
+    unsigned int *rows;
+    char *path;
+    size_t max_depth; // words longer than word_len + max_edits can't be within bound
+    suggestion *best; // max-heap of kept words, worst on top
+    size_t count;
+    size_t capacity;
+    size_t k;
+    bool ok;
+} suggest_walk;
+
+static void *load_shards(void *arg);
+static trie *create_local_trie(void);
+static void adopt_trie(trie *t, trie *local);
+static size_t descend_path(path_frame *path, size_t path_len, const mapped_word *w);
+static bool put_bulk_word(trie *t, const bulk_word *bw);
+static void walk_start(completion_cursor *c, const node *n, const char *prefix, size_t depth);
+static const node *walk_next(completion_cursor *c);
+static bool validate_word(const char *word, mapped_word *w);
+static bool validate_bulk_word(const bulk_word *bw, mapped_word *w);
+static node *put_node(trie *t, node *n, const mapped_word *w, size_t depth, insertion *ins);
+static void set_word(node *n, insertion *ins);
+static void update_max_score(node *n);
+static void account_insertion(node *n, const insertion *ins);
+static bool check_node(const node *t, const mapped_word *w, size_t depth);
+static node *get_final_node(node *n, const mapped_word *w, size_t *depth);
+static node *create_node(trie *t, enum NODE_KIND kind, const char *label, size_t len);
+static node *create_chain(trie *t, const mapped_word *w, size_t depth, insertion *ins);
+static bool topk_text(topk_heap *h, size_t len);
+static bool topk_push(topk_heap *h, unsigned int priority, bool is_word, const node *n,
+		      const topk_entry *parent, const char *label, size_t label_len);
+static topk_entry topk_pop(topk_heap *h);
+static bool topk_before(const topk_heap *h, const topk_entry *a, const topk_entry *b);
+static bool walk_push(completion_cursor *c, const node *n, size_t depth);
+static void suggest_node(suggest_walk *w, const node *n, size_t depth, size_t done);
+static bool suggest_child(suggest_walk *w, const node *n, const node *child, int idx, size_t depth);
+static int suggest_bound(const suggest_walk *w, unsigned int max_score);
+static bool suggest_row(suggest_walk *w, size_t depth, unsigned int bound);
+static void suggest_keep(suggest_walk *w, unsigned int distance, unsigned int score, size_t len);
+static void suggest_sift_down(suggest_walk *w, size_t i);
+static int suggestion_cmp(const void *a, const void *b);
+static bool fill_word(const char *word, size_t len, void *ctx);
+static bool record_word(const char *word, size_t len, void *ctx);
+static void replay_words(const cache_entry *e, completion_cb cb, void *ctx);
+static node *split_node(trie *t, node *n, size_t at);
+static node *merge_node(trie *t, node *n);
+static size_t match_label(const node *n, const char *word);
+static node **child_slot(node *n, int idx);
+static int child_key(const node *n, int pos);
+static node *add_child(trie *t, node *n, int idx, node *child);
+static void insert_child(node *n, int idx, node *child);
+static void remove_child(node *n, int idx);
+static node *resize_node(trie *t, node *n, enum NODE_KIND kind);
+static node *shrink_node(trie *t, node *n);
+static node *compact_node(trie *t, node *n);
+static bool delete_word(trie *t, const mapped_word *w);
+static node *writable_node(trie *t, node *n);
+static void release_node(trie *t, node *n);
+static void writer_lock(trie *t);
+static void writer_unlock(trie *t);
+static int reader_enter(const trie *t);
+static void reader_exit(const trie *t, int slot);
+static void write_dot_node(FILE *fp, size_t id, const char *label, size_t len, const char *color);
+static pid_t spawn_renderer(int *fd, const char *svg_out_name);
+static bool track_renderer(pid_t pid);
+static void install_reaper(void);
+static void reap_renderers(int sig);
+static bool stats_node(const node *n, size_t depth, trie_stats *s);
+static void log_mutation(trie *t, enum JOURNAL_RECORD kind, const char *word, size_t len, unsigned int score);
+static void log_bulk_words(trie *t, const bulk_word *words, size_t count);
+static bool rewrite_journal(trie *t);
+static bool replay_record(enum JOURNAL_RECORD kind, const char *word, size_t len, unsigned int score, void *ctx);
+static void replay_puts(replay_batch *b);
 
-static char *traverse_trie(const node *n, char *prefix, size_t prefix_len, FILE *out);
-static bool validate_word(const char *word);
-static node *put_node(node *parent, const char *word);
-static bool check_node(const node *t, const char *word);
-static node *get_final_node(node *n, const char *word);
-static node *create_node(char with);
-static void free_node(node *n);
-static void dot_node(FILE *fp, const node *n);
-static void rebuild_trie_if_threshold_passed(trie *t);
-static enum NODE_TYPE clean_orphan_nodes(node *n);
-static void free_orphan_node(node *n);
-static void generate_svg_from_dot(char **args);
+/*
+ * Renderers started by visualize_trie and not reaped yet, free slots hold 0
+ */
+static _Atomic pid_t renderers[MAX_PENDING_RENDERERS];
 
 trie *create_trie()
 {
@@ -59,374 +256,2348 @@ trie *create_trie()
 	return NULL;
     }
 
-    node *root = create_node(ROOT_CHAR);
+    pool_init(&t->nodes[NODE4], sizeof(node4));
+    pool_init(&t->nodes[NODE16], sizeof(node16));
+    pool_init(&t->nodes[NODE_FULL], sizeof(node_full));
+    t->epoch = NULL;
+    t->cache = NULL;
+    t->journal = NULL;
+    pthread_mutex_init(&t->writer, NULL);
+
+    node *root = create_node(t, NODE_FULL, NULL, 0);
     if (root == NULL) {
 	fprintf(stderr, "Memory allocation error\n");
+	free_trie(t);
 	return NULL;
     }
 
     t->root = root;
     t->size = 0;
-    t->delete_threshold = 0;
+    t->max_len = 0;
     return t;
 }
 
 void free_trie(trie *t)
 {
-    free_node(t->root);
+    close_journal(t->journal);
+    free_completion_cache(t->cache);
+    free_epoch_domain(t->epoch);
+    for (int kind = 0; kind < NODE_KINDS; kind++) {
+	pool_destroy(&t->nodes[kind]);
+    }
+    pthread_mutex_destroy(&t->writer);
     free(t);
 }
 
-void reset_trie(trie *t)
+/*
+ * Allows check, complete, complete_topk and suggest to run on any number of threads while
+ * other threads insert and delete words. Readers take no locks, writers are serialized, nodes
+ * are changed through copies and unlinked nodes are freed after an epoch grace period.
+ * Cursors, reset and freeze still require exclusive access.
+ */
+bool enable_concurrent_mode(trie *t)
 {
-    node *root = t->root;
-    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	node *child = *(root->children + i);
-	free_node(child);
-	*(root->children + i) = NULL;
+    if (t->epoch == NULL) {
+	t->epoch = create_epoch_domain();
     }
-    t->size = 0;
-    t->delete_threshold = 0;
+    return t->epoch != NULL;
 }
 
-static void free_node(node *n)
+/*
+ * Keeps results of complete in an LRU cache bounded by max_bytes. Adding or deleting a word
+ * drops only results of its prefixes, loads and reset drop every result.
+ */
+bool enable_completion_cache(trie *t, size_t max_bytes)
 {
-    if (n == NULL) {
-	return;
+    if (t->cache == NULL) {
+	t->cache = create_completion_cache(max_bytes);
     }
+    return t->cache != NULL;
+}
 
-    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	free_node(*(n->children + i));
+/*
+ * Replays journal file into t and appends every following mutation to it. Records are
+ * made durable in batches by a background thread, sync_journal waits for them. Journal is
+ * rewritten into records of current words once it doubles, so replay stays proportional
+ * to the number of words rather than to the number of mutations. Mutation which triggers
+ * it only copies the words into memory, the background thread writes the new file.
+ */
+bool enable_journal(trie *t, const char *path)
+{
+    if (t->journal != NULL) {
+	return true;
     }
+    replay_batch b = { .t = t, .words = NULL, .count = 0, .capacity = 0 };
+    journal *j = open_journal(path, replay_record, &b);
+    free(b.words);
+    if (j == NULL) {
+	return false;
+    }
+    t->journal = j;
+    return true;
+}
 
-    free(n->children);
-    free(n);
+/*
+ * Waits until every mutation is on disk, returns false if journal couldn't be written
+ */
+bool sync_journal(trie *t)
+{
+    return t->journal == NULL || journal_sync(t->journal);
 }
 
-bool put(trie *t, const char *word)
+/*
+ * Rewrites journal into records of current words right away and waits for the new file
+ */
+bool compact_journal(trie *t)
 {
-    if (!validate_word(word)) {
+    if (t->journal == NULL) {
 	return false;
     }
-    int idx = hash(*word);
-    *(t->root->children + idx) = put_node(*(t->root->children + idx), word);
-    t->size++;
-    return true;
+    journal_rewrite_wait(t->journal); // compaction in progress, if any
+    writer_lock(t);
+    bool ok = rewrite_journal(t);
+    writer_unlock(t);
+    return ok && journal_rewrite_wait(t->journal);
 }
 
-#ifdef DEBUG
-void visualize_trie_debug(const trie *t)
+/*
+ * Removes every word, reset is journaled
+ */
+void reset_trie(trie *t)
 {
-    FILE *dot_fp = fopen("out.dot", "w");
-    visualize_trie(dot_fp, "out.dot", "out.svg", t);
-    fclose(dot_fp);
+    log_mutation(t, JOURNAL_RESET, "", 0, 0);
+    release_words(t);
 }
-#endif
 
-static node *put_node(node *parent, const char *word)
+/*
+ * Drops every slab of node arenas at once and starts over with a fresh root. Journal is
+ * not touched, so it keeps the words, e.g. of a trie released after it was frozen.
+ */
+void release_words(trie *t)
 {
-    if (parent == NULL) {
-	parent = create_node(*word);
-	if (parent == NULL) {
-	    fprintf(stderr, "Memory allocation error\n");
-	    return NULL;
-	}
+    if (t->cache != NULL) {
+	cache_flush(t->cache);
     }
-    int idx = hash(*(word + 1));
-    if (idx == -1) {
-	parent->eow = true;
-    } else {
-	*(parent->children + idx) = put_node(*(parent->children + idx), word + 1);
+    for (int kind = 0; kind < NODE_KINDS; kind++) {
+	pool_reset(&t->nodes[kind]);
     }
-    return parent;
+    if (t->epoch != NULL) {
+	epoch_forget(t->epoch);
+    }
+    t->root = create_node(t, NODE_FULL, NULL, 0);
+    t->size = 0;
+    t->max_len = 0;
 }
 
-bool delete(trie *t, const char *word)
+/*
+ * Walks every node of the trie. Writer lock is held, so in concurrent mode
+ * pools don't change during the walk while readers keep running.
+ */
+void collect_stats(trie *t, trie_stats *s)
 {
-    if (!validate_word(word)) {
-	return false;
+    *s = (trie_stats) { 0 };
+    writer_lock(t);
+    s->words = t->size;
+    stats_node(t->root, 0, s);
+    for (int kind = 0; kind < NODE_KINDS; kind++) {
+	s->reserved_bytes += pool_reserved_bytes(&t->nodes[kind]);
     }
-
-    int idx = hash(*word);
-    node *n = get_final_node(*(t->root->children + idx), word);
-    if (n == NULL) {
-	return false;
+    writer_unlock(t);
+    if (t->cache != NULL) {
+	pthread_mutex_lock(&t->cache->lock);
+	s->cache_entries = t->cache->count;
+	s->cache_bytes = t->cache->bytes;
+	s->cache_hits = t->cache->hits;
+	s->cache_misses = t->cache->misses;
+	pthread_mutex_unlock(&t->cache->lock);
     }
-    n->eow = false;
-    t->size--;
-    t->delete_threshold++;
-    rebuild_trie_if_threshold_passed(t);
-    return true;
 }
 
 /*
- * Rebalances trie if number of deletions reaches DELETE_THRESHOLD
+ * Accounts n and its subtree, returns whether any word ends in the subtree
  */
-static void rebuild_trie_if_threshold_passed(trie *t)
+static bool stats_node(const node *n, size_t depth, trie_stats *s)
 {
-    if (t->delete_threshold < DELETE_THRESHOLD) return;
-
-#ifdef DEBUG
-    printf("[DEBUG] Rebuilding the trie...\n");
-#endif
-    node *root = t->root;
-    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	node *child = *(root->children + i);
+    static const size_t node_size[NODE_KINDS] = { sizeof(node4), sizeof(node16), sizeof(node_full) };
+    s->nodes++;
+    s->nodes_by_kind[n->kind]++;
+    s->node_bytes += node_size[n->kind];
+    s->label_chars += n->len;
+    s->depth_histogram[depth < STATS_DEPTH_BUCKETS ? depth : STATS_DEPTH_BUCKETS - 1]++;
+    s->fanout_histogram[n->count]++;
+    if (depth > s->max_depth) {
+	s->max_depth = depth;
+    }
 
-	enum NODE_TYPE type = clean_orphan_nodes(child);
-	if (type == ORPHAN_NODE) {
-	    *(root->children + i) = NULL;
+    bool has_word = n->eow;
+    int pos = 0;
+    node *child;
+    while ((child = next_child(n, &pos)) != NULL) {
+	has_word |= stats_node(child, depth + 1, s);
+	if (depth > 0 && !n->eow && n->count == 1 && n->len + child->len <= MAX_LABEL_LEN) {
+	    s->mergeable_nodes++;
 	}
     }
-
-    t->delete_threshold = 0;
+    if (depth > 0 && !has_word) {
+	s->dead_nodes++;
+    }
+    return has_word;
 }
 
-#if 0
-static void debug_node(const node *n)
+/*
+ * Appends record of mutation, writer lock is held. Journal which outgrew the words it
+ * leads to is rewritten from a snapshot of them.
+ */
+static void log_mutation(trie *t, enum JOURNAL_RECORD kind, const char *word, size_t len, unsigned int score)
 {
-    printf("Node { ch = %c, eow = %i }\n", n->ch, n->eow);
+    if (t->journal == NULL) {
+	return;
+    }
+    if (!journal_append(t->journal, kind, word, len, score)) {
+	fprintf(stderr, "Mutation couldn't be journaled, it is not durable\n");
+    }
+    if (journal_needs_compaction(t->journal)) {
+	rewrite_journal(t);
+    }
 }
-#endif
 
-static enum NODE_TYPE clean_orphan_nodes(node *n)
+/*
+ * Appends record of every word of a load, words which are not valid are dropped on replay
+ */
+static void log_bulk_words(trie *t, const bulk_word *words, size_t count)
 {
-    if (n == NULL) {
-	return LEAF_NODE;
+    if (t->journal == NULL) {
+	return;
     }
-
-    bool reduntant = true;
-    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	node *child = *(n->children + i);
-
-	enum NODE_TYPE type = clean_orphan_nodes(child);
-
-	if (type == ORPHAN_NODE) {
-	    *(n->children + i) = NULL;
+    size_t lost = 0;
+    for (size_t i = 0; i < count; i++) {
+	const bulk_word *bw = &words[i];
+	if (bw->len > 0 && bw->len <= MAX_WORD_LEN
+	    && !journal_append(t->journal, bw->scored ? JOURNAL_PUT_SCORED : JOURNAL_PUT, bw->word, bw->len, bw->score)) {
+	    lost++;
 	}
+    }
+    if (lost > 0) {
+	fprintf(stderr, "%zu loaded words couldn't be journaled, they are not durable\n", lost);
+    }
+    if (journal_needs_compaction(t->journal)) {
+	rewrite_journal(t);
+    }
+}
 
-	if (type == EOW_NODE) {
-	    reduntant = false;
+/*
+ * Replaces journal with a reset record followed by a record of every word, in order, so
+ * replay inserts them as a sorted load. Writer lock is held while the records are encoded
+ * into memory, the journal flusher writes them.
+ */
+static bool rewrite_journal(trie *t)
+{
+    journal *j = t->journal;
+    if (!journal_rewrite_begin(j)) {
+	return false;
+    }
+    bool ok = journal_rewrite_append(j, JOURNAL_RESET, "", 0, 0);
+    DECLARE_WALK(c, t);
+    walk_start(&c, t->root, NULL, 0);
+    const node *n;
+    while (ok && (n = walk_next(&c)) != NULL) {
+	if (n->eow) {
+	    size_t len = c.stack[c.stack_len - 1].depth + n->len;
+	    ok = journal_rewrite_append(j, n->score > 0 ? JOURNAL_PUT_SCORED : JOURNAL_PUT, c.prefix, len, n->score);
 	}
     }
+    return journal_rewrite_end(j, ok);
+}
 
-    if (!n->eow && reduntant) {
-	free_orphan_node(n);
-    } else {
-	reduntant = false;
+/*
+ * Applies replayed record, puts are collected and inserted together before the next
+ * delete, reset or the end of journal
+ */
+static bool replay_record(enum JOURNAL_RECORD kind, const char *word, size_t len, unsigned int score, void *ctx)
+{
+    replay_batch *b = ctx;
+    if (kind == JOURNAL_PUT || kind == JOURNAL_PUT_SCORED) {
+	if (b->count == b->capacity) {
+	    size_t capacity = b->capacity > 0 ? b->capacity * 2 : JOURNAL_BUFFER_SIZE;
+	    bulk_word *words = realloc(b->words, sizeof(bulk_word) * capacity);
+	    if (words == NULL) {
+		fprintf(stderr, "Memory allocation error\n");
+		return false;
+	    }
+	    b->words = words;
+	    b->capacity = capacity;
+	}
+	b->words[b->count++] = (bulk_word) {
+	    .word = word, .len = len, .score = score, .scored = kind == JOURNAL_PUT_SCORED
+	};
+	return true;
     }
-
-    return reduntant ? ORPHAN_NODE : EOW_NODE;
+    replay_puts(b);
+    if (kind == JOURNAL_RESET) {
+	reset_trie(b->t);
+    } else if (kind == JOURNAL_DELETE && len <= MAX_WORD_LEN) {
+	char deleted[MAX_WORD_LEN + 1];
+	memcpy(deleted, word, len);
+	deleted[len] = '\0';
+	delete(b->t, deleted);
+    }
+    return true;
 }
 
-static void free_orphan_node(node *n)
+static void replay_puts(replay_batch *b)
 {
-    free(n->children);
-    free(n);
+    if (b->count > 0) {
+	put_sorted(b->t, b->words, b->count);
+	b->count = 0;
+    }
 }
 
-bool check(const trie *t, const char *word)
+/*
+ * Inserts word, score of already existing word is kept
+ */
+bool put(trie *t, const char *word)
 {
-    if (!validate_word(word)) {
+    mapped_word w;
+    if (!validate_word(word, &w)) {
 	return false;
     }
-    int idx = hash(*word);
-    return check_node(*(t->root->children + idx), word);
+    insertion ins = { .score = 0, .scored = false, .added = false, .lowered = false };
+    writer_lock(t);
+    STORE_SHARED(t->root, put_node(t, t->root, &w, 0, &ins));
+    if (ins.added) {
+	t->size++;
+	t->max_len = w.len > t->max_len ? w.len : t->max_len;
+	if (t->cache != NULL) {
+	    cache_invalidate(t->cache, word, w.len);
+	}
+	log_mutation(t, JOURNAL_PUT, word, w.len, 0);
+    }
+    writer_unlock(t);
+    return true;
 }
 
-static bool check_node(const node *n, const char *word)
+/*
+ * Inserts word with given score (e.g. frequency), score of existing word is replaced
+ */
+bool put_scored(trie *t, const char *word, unsigned int score)
 {
-    if (n == NULL) {
+    mapped_word w;
+    if (!validate_word(word, &w)) {
 	return false;
     }
-    int idx = hash(*(word + 1));
-    if (idx == -1 && n != NULL) {
-	return n->eow;
+    insertion ins = { .score = score, .scored = true, .added = false, .lowered = false };
+    writer_lock(t);
+    STORE_SHARED(t->root, put_node(t, t->root, &w, 0, &ins));
+    if (ins.added) {
+	t->size++;
+	t->max_len = w.len > t->max_len ? w.len : t->max_len;
+	if (t->cache != NULL) {
+	    cache_invalidate(t->cache, word, w.len);
+	}
     }
-    return check_node(*(n->children + idx), word + 1);
+    log_mutation(t, JOURNAL_PUT_SCORED, word, w.len, score);
+    writer_unlock(t);
+    return true;
 }
 
-void complete(const trie *t, const char *word)
+/*
+ * Inserts words on up to threads workers, calling thread is one of them.
+ * Returns number of newly added words.
+ */
+unsigned int put_parallel(trie *t, const bulk_word *words, size_t count, unsigned int threads)
 {
-    if (!validate_word(word)) {
-	return;
+    // workers grow published subtrees without copying them, concurrent mode inserts serially
+    if (t->epoch != NULL) {
+	writer_lock(t);
+	unsigned int size = t->size;
+	for (size_t i = 0; i < count; i++) {
+	    put_bulk_word(t, &words[i]);
+	}
+	unsigned int added = t->size - size;
+	if (added > 0 && t->cache != NULL) {
+	    cache_flush(t->cache);
+	}
+	log_bulk_words(t, words, count);
+	writer_unlock(t);
+	return added;
     }
-    int idx = hash(*word);
-    node *n = get_final_node(*(t->root->children + idx), word);
 
-    size_t prefix_len = strlen(word);
-    char *prefix = malloc((sizeof(char) * prefix_len) + 1);
-    if (prefix == NULL) {
+    load_job job = { .t = t, .words = words, .next_shard = 0 };
+    size_t *order = malloc(sizeof(size_t) * (count > 0 ? count : 1));
+    if (order == NULL) {
 	fprintf(stderr, "Memory allocation error\n");
-	return;
+	return 0;
     }
-    strcpy(prefix, word);
 
-    prefix = traverse_trie(n, prefix, prefix_len, stdout);
-    if (prefix == NULL) {
-	fprintf(stderr, "Memory allocation error\n");
-	return;
+    // stable counting sort of word indices by shard, words with invalid first char are dropped
+    size_t shard_size[NUMBER_OF_LETTERS] = { 0 };
+    for (size_t i = 0; i < count; i++) {
+	int s = hash(words[i].word[0]);
+	if (s >= 0) {
+	    shard_size[s]++;
+	}
     }
-    free(prefix);
-}
+    job.shard_start[0] = 0;
+    for (int s = 0; s < NUMBER_OF_LETTERS; s++) {
+	job.shard_start[s + 1] = job.shard_start[s] + shard_size[s];
+	job.owner[s] = -1;
+    }
+    size_t fill[NUMBER_OF_LETTERS];
+    memcpy(fill, job.shard_start, sizeof(fill));
+    for (size_t i = 0; i < count; i++) {
+	int s = hash(words[i].word[0]);
+	if (s >= 0) {
+	    order[fill[s]++] = i;
+	}
+    }
+    job.order = order;
 
-#ifdef DEBUG
-void print_trie(const trie *t)
-{
-    size_t prefix_len = 1;
+    // a worker without a shard would only add an idle private trie
+    unsigned int shards = 0;
+    for (int s = 0; s < NUMBER_OF_LETTERS; s++) {
+	shards += shard_size[s] > 0;
+    }
+    if (threads < 1) {
+	threads = 1;
+    }
+    if (threads > shards) {
+	threads = shards;
+    }
+    if (threads == 0) {
+	free(order);
+	return 0;
+    }
+    load_worker workers[threads];
+    pthread_t ids[threads];
+    bool started[threads];
+    unsigned int worker_count = 0;
+    for (unsigned int i = 0; i < threads; i++) {
+	trie *local = create_local_trie();
+	if (local == NULL) {
+	    break;
+	}
+	workers[worker_count] = (load_worker) { .job = &job, .local = local, .id = worker_count };
+	started[worker_count] = false;
+	worker_count++;
+    }
+    if (worker_count == 0) {
+	free(order);
+	return 0;
+    }
 
-    char *prefix = malloc((sizeof(char) * prefix_len) + 1);
-    if (prefix == NULL) {
-    	fprintf(stderr, "Memory allocation error\n");
-	return;
+    for (unsigned int i = 1; i < worker_count; i++) {
+	started[i] = pthread_create(&ids[i], NULL, load_shards, &workers[i]) == 0;
+    }
+    load_shards(&workers[0]);
+    for (unsigned int i = 1; i < worker_count; i++) {
+	if (started[i]) {
+	    pthread_join(ids[i], NULL);
+	}
     }
 
-    prefix = traverse_trie(t->root, prefix, prefix_len, stdout);
-    if (prefix == NULL) {
-	fprintf(stderr, "Memory allocation error\n");
-	return;
+    // stitch built shards under root, replacing subtrees they were grown from
+    unsigned int added = 0;
+    for (int s = 0; s < NUMBER_OF_LETTERS; s++) {
+	if (job.owner[s] < 0) {
+	    continue;
+	}
+	node *child = find_child(workers[job.owner[s]].local->root, s);
+	remove_child(t->root, s);
+	t->root = add_child(t, t->root, s, child);
+    }
+    for (unsigned int i = 0; i < worker_count; i++) {
+	trie *local = workers[i].local;
+	added += local->size;
+	t->size += local->size;
+	t->max_len = local->max_len > t->max_len ? local->max_len : t->max_len;
+	adopt_trie(t, local);
     }
-    free(prefix);
+    update_max_score(t->root);
+    t->root->words = t->size;
+    if (added > 0 && t->cache != NULL) {
+	cache_flush(t->cache);
+    }
+    log_bulk_words(t, words, count);
+
+    free(order);
+    return added;
 }
-#endif
 
-void generate_txt_file(FILE *fp, const trie *t)
+/*
+ * Inserts words sorted in ascending byte order (which is slot order). Path of the previous
+ * word is kept, so each word is inserted below the deepest node of the common prefix instead
+ * of from root. Out of order words are inserted from root.
+ * Returns number of newly added words.
+ */
+unsigned int put_sorted(trie *t, const bulk_word *words, size_t count)
 {
-    node *root = t->root;
-    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	node *child = *(root->children + i);
+    path_frame path[MAX_WORD_LEN + 1];
+    path[0] = (path_frame) { .n = t->root, .depth = 0 };
+    size_t path_len = 1;
+    bulk_word prev = { .word = "", .len = 0 };
+    unsigned int added = 0;
+    mapped_word w;
+    writer_lock(t);
 
-	size_t prefix_len = 1;
-	char *prefix = malloc((sizeof(char) * prefix_len) + 1);
-	if (prefix == NULL) {
-	    fprintf(stderr, "Memory allocation error\n");
-	    return;
+    for (size_t i = 0; i < count; i++) {
+	const bulk_word *bw = &words[i];
+	if (!validate_bulk_word(bw, &w)) {
+	    continue;
+	}
+	insertion ins = { .score = bw->score, .scored = bw->scored, .added = false, .lowered = false };
+	size_t common = 0;
+	size_t shorter = bw->len < prev.len ? bw->len : prev.len;
+	while (common < shorter && prev.word[common] == bw->word[common]) {
+	    common++;
 	}
+	// chars compare as unsigned bytes, which follow slot order
+	bool ordered = common == shorter ? bw->len >= prev.len
+		       : (unsigned char) bw->word[common] > (unsigned char) prev.word[common];
 
-	prefix = traverse_trie(child, prefix, prefix_len, fp);
-	if (prefix == NULL) {
-	    fprintf(stderr, "Memory allocation error\n");
-	    return;
+	if (!ordered) {
+	    STORE_SHARED(t->root, put_node(t, t->root, &w, 0, &ins));
+	    path[0].n = t->root;
+	    path_len = descend_path(path, 1, &w);
+	} else {
+	    // rewind to the deepest node whose label lies within the common prefix
+	    while (path[path_len - 1].depth + path[path_len - 1].n->len > common) {
+		path_len--;
+	    }
+	    path_frame *top = &path[path_len - 1];
+	    top->n = put_node(t, top->n, &w, top->depth, &ins);
+	    if (path_len == 1) {
+		STORE_SHARED(t->root, top->n);
+	    } else {
+		STORE_SHARED(*child_slot(path[path_len - 2].n, w.slots[top->depth]), top->n);
+	    }
+	    for (size_t j = path_len - 1; j > 0; j--) {
+		account_insertion(path[j - 1].n, &ins);
+	    }
+	    path_len = descend_path(path, path_len, &w);
+	}
+	prev = *bw;
+
+	if (ins.added) {
+	    added++;
+	    t->size++;
+	    t->max_len = bw->len > t->max_len ? bw->len : t->max_len;
 	}
-	free(prefix);
     }
+    if (added > 0 && t->cache != NULL) {
+	cache_flush(t->cache);
+    }
+    log_bulk_words(t, words, count);
+    writer_unlock(t);
+    return added;
 }
 
-static char *traverse_trie(const node *n, char *prefix, size_t prefix_len, FILE *out)
+/*
+ * Extends path from its last node down to the node which holds the last char of word
+ */
+static size_t descend_path(path_frame *path, size_t path_len, const mapped_word *w)
 {
-    if (n == NULL) {
-	return prefix;
-    }
-    EXPAND_PREFIX(prefix, prefix_len, n->ch);
-    if (n->eow) {
-	fprintf(out, "%s\n", prefix);
+    const path_frame *top = &path[path_len - 1];
+    size_t depth = top->depth + top->n->len;
+    node *n = top->n;
+    while (depth < w->len) {
+	n = find_child(n, w->slots[depth]);
+	if (n == NULL) {
+	    break;
+	}
+	path[path_len++] = (path_frame) { .n = n, .depth = depth };
+	depth += n->len;
     }
-    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	prefix = traverse_trie(*(n->children + i), prefix, prefix_len + 1, out);
+    return path_len;
+}
+
+/*
+ * Worker of parallel load, claims shards until none is left
+ */
+static void *load_shards(void *arg)
+{
+    load_worker *w = arg;
+    load_job *job = w->job;
+    int s;
+    while ((s = atomic_fetch_add(&job->next_shard, 1)) < NUMBER_OF_LETTERS) {
+	if (job->shard_start[s] == job->shard_start[s + 1]) {
+	    continue;
+	}
+	job->owner[s] = w->id;
+
+	// existing subtree of shard keeps growing in private trie, shared root is only read
+	node *existing = find_child(job->t->root, s);
+	if (existing != NULL) {
+	    w->local->root = add_child(w->local, w->local->root, s, existing);
+	}
+	for (size_t i = job->shard_start[s]; i < job->shard_start[s + 1]; i++) {
+	    put_bulk_word(w->local, &job->words[job->order[i]]);
+	}
     }
-    return prefix;
+    return NULL;
 }
 
-static node *get_final_node(node *n, const char *word)
+static bool put_bulk_word(trie *t, const bulk_word *bw)
 {
-    if (n == NULL) {
-	return NULL;
+    mapped_word w;
+    if (!validate_bulk_word(bw, &w)) {
+	return false;
     }
-    int idx = hash(*(word + 1));
-    if (idx == -1 && n != NULL) {
-	return n;
+    insertion ins = { .score = bw->score, .scored = bw->scored, .added = false, .lowered = false };
+    STORE_SHARED(t->root, put_node(t, t->root, &w, 0, &ins));
+    if (ins.added) {
+	t->size++;
+	t->max_len = bw->len > t->max_len ? bw->len : t->max_len;
     }
-    return get_final_node(*(n->children + idx), word + 1);
+    return true;
 }
 
-void visualize_trie(FILE *dot_fp, char *dot_out_name, char *svg_out_name, const trie *t)
+/*
+ * Private trie of parallel load worker. Its root is not carved from a pool, so pools of
+ * the worker get slabs only for nodes it builds and adopting them reserves nothing idle.
+ */
+static trie *create_local_trie(void)
 {
-    if (t->size > GRAPH_VISUALIZER_LIMIT) {
-	fprintf(stderr, "Size of trie [%d] has reached to graph visualizer limit [%d]\n",
-		t->size, GRAPH_VISUALIZER_LIMIT);
-	return;
+    trie *t = malloc(sizeof(trie));
+    node *root = calloc(1, sizeof(node_full));
+    if (t == NULL || root == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	free(t);
+	free(root);
+	return NULL;
     }
-    generate_dot_file(dot_fp, t);
-
-    char *args[] = {
-	DOT_LAYOUT_ENGINE, DOT_GRAPH_FORMAT_FLAG, dot_out_name, "-o", svg_out_name, NULL
-    };
 
-    generate_svg_from_dot(args);
+    pool_init(&t->nodes[NODE4], sizeof(node4));
+    pool_init(&t->nodes[NODE16], sizeof(node16));
+    pool_init(&t->nodes[NODE_FULL], sizeof(node_full));
+    t->epoch = NULL;
+    t->cache = NULL;
+    t->journal = NULL;
+    pthread_mutex_init(&t->writer, NULL);
+    root->kind = NODE_FULL;
+    t->root = root;
+    t->size = 0;
+    t->max_len = 0;
+    return t;
 }
 
-void generate_dot_file(FILE *fp, const trie *t)
+/*
+ * Moves nodes of private trie into t and releases the private trie itself
+ */
+static void adopt_trie(trie *t, trie *local)
 {
-    fprintf(fp, "digraph {\n");
-
-    node *root = t->root;
-    fprintf(fp, DOT_FILE_ROOT_NODE_FORMAT,
-	    (void *) root, root->ch, ROOT_NODE_COLOR);
-    dot_node(fp, root);
+    for (int kind = 0; kind < NODE_KINDS; kind++) {
+	pool_adopt(&t->nodes[kind], &local->nodes[kind]);
+    }
+    free(local->root);
+    pthread_mutex_destroy(&local->writer);
+    free(local);
+}
 
-    fprintf(fp, "}\n");
+#ifdef DEBUG
+void visualize_trie_debug(const trie *t)
+{
+    if (t->size <= GRAPH_VISUALIZER_LIMIT) {
+	visualize_trie(t, "out.svg", NULL, 0);
+    }
 }
+#endif
 
-static void dot_node(FILE *fp, const node *n)
+/*
+ * Inserts word into subtree of n, where char of word at depth is the first char of n's label.
+ * Label is split at the first mismatch, returned node replaces n in its parent.
+ */
+static node *put_node(trie *t, node *n, const mapped_word *w, size_t depth, insertion *ins)
 {
-    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	node *child = *(n->children + i);
-	if (child != NULL) {
-	    fprintf(fp, DOT_FILE_CHILD_NODE_FORMAT,
-		    (void *) child, child->ch,
-		    child->eow ? EOW_CHILD_NODE_COLOR : CHILD_NODE_COLOR);
-	    fprintf(fp, "  \"%p\" -> \"%p\"\n", (void *) n, (void *) child);
-	    dot_node(fp, child);
+    if (n == NULL) {
+	return create_chain(t, w, depth, ins);
+    }
+    size_t matched = match_label(n, w->chars + depth);
+    if (matched < n->len) {
+	node *parent = split_node(t, n, matched);
+	if (parent == NULL) {
+	    return n;
 	}
+	n = parent;
+    }
+    depth += n->len;
+    if (depth == w->len) {
+	set_word(n, ins);
+	account_insertion(n, ins);
+	return n;
+    }
+    int idx = w->slots[depth];
+    node **slot = child_slot(n, idx);
+    if (slot != NULL) {
+	STORE_SHARED(*slot, put_node(t, *slot, w, depth, ins));
+    } else {
+	n = add_child(t, n, idx, create_chain(t, w, depth, ins));
     }
+    account_insertion(n, ins);
+    return n;
 }
 
-static void generate_svg_from_dot(char **args)
+/*
+ * Marks n as end of inserted word and applies score of insertion
+ */
+static void set_word(node *n, insertion *ins)
 {
-    if (fork() == 0) {
-	execvp("dot", args);
-	fprintf(stderr, "Unknown args\n");
+    if (!n->eow) {
+	STORE_SHARED(n->score, ins->score);
+	STORE_SHARED(n->eow, true);
+	ins->added = true;
+    } else if (ins->scored) {
+	ins->lowered = ins->score < n->score;
+	STORE_SHARED(n->score, ins->score);
     }
 }
 
-int hash(char ch)
+/*
+ * Recomputes best score in subtree of n from its own score and its children
+ */
+static void update_max_score(node *n)
 {
-    if (IS_CPTL_LTR(ch)) {
-	return ch - 65;
-    }
-    if (IS_LWR_LTR(ch)) {
-	return ch - 71;
+    unsigned int max_score = n->eow ? n->score : 0;
+    int pos = 0;
+    node *child;
+    while ((child = next_child(n, &pos)) != NULL) {
+	if (child->max_score > max_score) {
+	    max_score = child->max_score;
+	}
     }
-    return -1;
+    STORE_SHARED(n->max_score, max_score);
 }
 
-static bool validate_word(const char *word)
+/*
+ * Accounts inserted word in word count and best score of n, which lies on the insertion path
+ */
+static void account_insertion(node *n, const insertion *ins)
 {
-    if (*word == '\0') {
-	return false;
+    if (ins->added) {
+	STORE_SHARED(n->words, n->words + 1);
     }
-    while (*word != '\0') {
-	if (!IS_VALID_CHAR(*word)) {
-	    return false;
-	}
-	word++;
+    if (ins->lowered) {
+	update_max_score(n);
+    } else if (ins->score > n->max_score) {
+	STORE_SHARED(n->max_score, ins->score);
     }
-    return true;
 }
 
-static node *create_node(char with)
+/*
+ * Creates nodes for the rest of a word from depth, MAX_LABEL_LEN chars per node
+ */
+static node *create_chain(trie *t, const mapped_word *w, size_t depth, insertion *ins)
 {
-    node *n = malloc(sizeof(node));
+    size_t len = w->len - depth < MAX_LABEL_LEN ? w->len - depth : MAX_LABEL_LEN;
+    node *n = create_node(t, NODE4, w->chars + depth, len);
     if (n == NULL) {
+	return NULL;
+    }
+    if (depth + len == w->len) {
+	set_word(n, ins);
+    } else {
+	node *rest = create_chain(t, w, depth + len, ins);
+	if (rest != NULL) {
+	    insert_child(n, w->slots[depth + len], rest);
+	}
+    }
+    n->max_score = ins->score;
+    n->words = ins->added ? 1 : 0;
+    return n;
+}
+
+/*
+ * Cuts label of n after given number of chars. Head of the label moves into a new
+ * parent node that replaces n, n keeps the tail.
+ */
+static node *split_node(trie *t, node *n, size_t at)
+{
+    node *parent = create_node(t, NODE4, n->label, at);
+    if (parent == NULL) {
+	return NULL;
+    }
+    n = writable_node(t, n);
+    if (n == NULL) {
+	pool_free(&t->nodes[NODE4], parent);
+	return NULL;
+    }
+    memmove(n->label, n->label + at, n->len - at);
+    n->len -= at;
+    parent->max_score = n->max_score;
+    parent->words = n->words;
+    insert_child(parent, hash(n->label[0]), n);
+    return parent;
+}
+
+/*
+ * Returns number of leading chars shared by label of n and word
+ */
+static size_t match_label(const node *n, const char *word)
+{
+    size_t i = 0;
+    while (i < n->len && n->label[i] == word[i]) {
+	i++;
+    }
+    return i;
+}
+
+bool delete(trie *t, const char *word)
+{
+    mapped_word w;
+    if (!validate_word(word, &w)) {
+	return false;
+    }
+    writer_lock(t);
+    bool deleted = delete_word(t, &w);
+    if (deleted && t->cache != NULL) {
+	cache_invalidate(t->cache, word, w.len);
+    }
+    if (deleted) {
+	log_mutation(t, JOURNAL_DELETE, word, w.len, 0);
+    }
+    writer_unlock(t);
+    return deleted;
+}
+
+/*
+ * Unmarks word and unlinks the part of its path no other word goes through.
+ * Node which lost its word or child is merged or shrunk right away, so cost is bounded by word length.
+ */
+static bool delete_word(trie *t, const mapped_word *w)
+{
+    node *path[w->len + 1];
+    size_t path_len = 0;
+    node *n = t->root;
+    size_t depth = 0;
+    while (n != NULL) {
+	path[path_len++] = n;
+	if (match_label(n, w->chars + depth) < n->len) {
+	    return false;
+	}
+	depth += n->len;
+	if (depth == w->len) {
+	    break;
+	}
+	n = find_child(n, w->slots[depth]);
+    }
+    if (n == NULL || !n->eow) {
+	return false;
+    }
+    STORE_SHARED(n->eow, false);
+    STORE_SHARED(n->score, 0);
+    for (size_t i = 0; i < path_len; i++) {
+	STORE_SHARED(path[i]->words, path[i]->words - 1);
+    }
+
+    // nodes left without words below them form a tail of the path, root is never pruned
+    size_t last = path_len - 1;
+    size_t kept = last;
+    while (kept > 0 && !path[kept]->eow && path[kept]->count == (kept == last ? 0 : 1)) {
+	kept--;
+    }
+    node *survivor = path[kept];
+    if (kept < last) {
+	node *dead = path[kept + 1];
+	if (survivor->kind != NODE_FULL) {
+	    survivor = writable_node(t, survivor);
+	}
+	if (survivor != NULL) {
+	    remove_child(survivor, hash(dead->label[0]));
+	    for (size_t i = kept + 1; i < path_len; i++) {
+		release_node(t, path[i]);
+	    }
+	} else {
+	    survivor = path[kept];
+	}
+    }
+    if (kept > 0) {
+	survivor = compact_node(t, survivor);
+	if (survivor != path[kept]) {
+	    STORE_SHARED(*child_slot(path[kept - 1], hash(survivor->label[0])), survivor);
+	    path[kept] = survivor;
+	}
+    }
+
+    for (size_t i = kept + 1; i > 0; i--) {
+	update_max_score(path[i - 1]);
+    }
+    t->size--;
+    return true;
+}
+
+/*
+ * Returns node whose label and child arrays may be changed in place. In concurrent mode
+ * published n is copied and retired, caller publishes the copy instead of n.
+ */
+static node *writable_node(trie *t, node *n)
+{
+    if (t->epoch == NULL) {
+	return n;
+    }
+    return resize_node(t, n, n->kind);
+}
+
+/*
+ * Frees unlinked node, in concurrent mode not before readers which may hold it are gone
+ */
+static void release_node(trie *t, node *n)
+{
+    if (t->epoch == NULL) {
+	pool_free(&t->nodes[n->kind], n);
+    } else {
+	epoch_retire(t->epoch, &t->nodes[n->kind], n);
+    }
+}
+
+static void writer_lock(trie *t)
+{
+    if (t->epoch != NULL) {
+	pthread_mutex_lock(&t->writer);
+    }
+}
+
+/*
+ * Ends mutation, nodes retired by earlier mutations are freed once grace period passed
+ */
+static void writer_unlock(trie *t)
+{
+    if (t->epoch != NULL) {
+	epoch_collect(t->epoch);
+	pthread_mutex_unlock(&t->writer);
+    }
+}
+
+static int reader_enter(const trie *t)
+{
+    return t->epoch != NULL ? epoch_enter(t->epoch) : -1;
+}
+
+static void reader_exit(const trie *t, int slot)
+{
+    if (t->epoch != NULL) {
+	epoch_exit(t->epoch, slot);
+    }
+}
+
+bool check(const trie *t, const char *word)
+{
+    mapped_word w;
+    if (!validate_word(word, &w)) {
+	return false;
+    }
+    int slot = reader_enter(t);
+    bool found = check_node(LOAD_SHARED(t->root), &w, 0);
+    reader_exit(t, slot);
+    return found;
+}
+
+static bool check_node(const node *n, const mapped_word *w, size_t depth)
+{
+    if (n == NULL) {
+	return false;
+    }
+    if (match_label(n, w->chars + depth) < n->len) {
+	return false;
+    }
+    depth += n->len;
+    if (depth == w->len) {
+	return LOAD_SHARED(n->eow);
+    }
+    return check_node(find_child(n, w->slots[depth]), w, depth);
+}
+
+/*
+ * Passes every word starting with given prefix to cb in alphabetical order.
+ * With completion cache enabled, repeated prefix is served from cache without walking the trie.
+ */
+void complete(const trie *t, const char *word, completion_cb cb, void *ctx)
+{
+    mapped_word w;
+    if (!validate_word(word, &w)) {
+	return;
+    }
+    unsigned long stamp = 0;
+    if (t->cache != NULL) {
+	cache_entry *e = cache_acquire(t->cache, word, w.len, &stamp);
+	if (e != NULL) {
+	    replay_words(e, cb, ctx);
+	    cache_release(t->cache, e);
+	    return;
+	}
+    }
+    word_recorder r = { .cb = cb, .ctx = ctx, .limit = stamp != 0 ? t->cache->max_bytes : 0, .ok = true };
+
+    int slot = reader_enter(t);
+    size_t depth;
+    node *n = get_final_node(LOAD_SHARED(t->root), &w, &depth);
+    if (n != NULL) {
+	DECLARE_WALK(c, t);
+	walk_start(&c, n, word, depth);
+	if (stamp != 0) {
+	    complete_next(&c, record_word, &r, SIZE_MAX);
+	} else {
+	    complete_next(&c, cb, ctx, SIZE_MAX);
+	}
+    }
+    reader_exit(t, slot);
+
+    if (stamp != 0 && !r.ok) {
+	free(r.text);
+	cache_abandon(t->cache, word, w.len, stamp);
+    } else if (stamp != 0) {
+	if (r.len > 0 && r.len < r.capacity) {
+	    char *text = realloc(r.text, r.len);
+	    r.text = text != NULL ? text : r.text;
+	}
+	cache_fill(t->cache, word, w.len, stamp, r.text, r.len, r.count);
+    }
+}
+
+/*
+ * Caller-provided storage filled by complete_fill
+ */
+typedef struct
+{
+    char *buf;
+    size_t buf_size;
+    size_t used;
+    char **words;
+    size_t count;
+} fill_ctx;
+
+/*
+ * Passes at most k words starting with given prefix to cb in order of descending score
+ * (alphabetically among equal scores). Best-first search expands subtrees in order of their
+ * best score, so only the part of the subtree leading to the k best words is visited.
+ */
+void complete_topk(const trie *t, const char *word, unsigned int k, completion_cb cb, void *ctx)
+{
+    mapped_word w;
+    if (!validate_word(word, &w) || k == 0) {
+	return;
+    }
+    int slot = reader_enter(t);
+    size_t depth;
+    node *n = get_final_node(LOAD_SHARED(t->root), &w, &depth);
+    if (n == NULL) {
+	reader_exit(t, slot);
+	return;
+    }
+
+    topk_heap h = { 0 };
+    bool ok = topk_text(&h, depth);
+    if (ok && depth > 0) {
+	memcpy(h.text, word, depth);
+    }
+    if (ok) {
+	h.text_len = depth;
+	topk_entry prefix = { .text = 0, .text_len = depth };
+	ok = topk_push(&h, LOAD_SHARED(n->max_score), false, n, &prefix, n->label, n->len);
+    }
+    unsigned int emitted = 0;
+    while (ok && h.count > 0 && emitted < k) {
+	topk_entry e = topk_pop(&h);
+	if (e.is_word) {
+	    if (!cb(h.text + e.text, e.text_len, ctx)) {
+		break;
+	    }
+	    emitted++;
+	    continue;
+	}
+	if (LOAD_SHARED(e.n->eow)) {
+	    ok = topk_push(&h, LOAD_SHARED(e.n->score), true, NULL, &e, NULL, 0);
+	}
+	int pos = 0;
+	node *child;
+	while (ok && (child = next_child(e.n, &pos)) != NULL) {
+	    ok = topk_push(&h, LOAD_SHARED(child->max_score), false, child, &e,
+			   child->label, child->len);
+	}
+    }
+    reader_exit(t, slot);
+    if (!ok) {
+	fprintf(stderr, "Memory allocation error\n");
+    }
+    free(h.entries);
+    free(h.text);
+}
+
+/*
+ * Makes room for len more chars in text buffer of the heap
+ */
+static bool topk_text(topk_heap *h, size_t len)
+{
+    if (h->text_len + len <= h->text_capacity) {
+	return true;
+    }
+    size_t capacity = h->text_capacity == 0 ? 256 : h->text_capacity;
+    while (h->text_len + len > capacity) {
+	capacity *= 2;
+    }
+    char *text = realloc(h->text, capacity);
+    if (text == NULL) {
+	return false;
+    }
+    h->text = text;
+    h->text_capacity = capacity;
+    return true;
+}
+
+/*
+ * Pushes entry whose text is text of parent followed by label.
+ * Entry without label shares text of parent.
+ */
+static bool topk_push(topk_heap *h, unsigned int priority, bool is_word, const node *n,
+		      const topk_entry *parent, const char *label, size_t label_len)
+{
+    topk_entry e = {
+	.priority = priority, .is_word = is_word, .n = n,
+	.text = parent->text, .text_len = parent->text_len
+    };
+    if (label_len > 0) {
+	if (!topk_text(h, parent->text_len + label_len)) {
+	    return false;
+	}
+	e.text = h->text_len;
+	e.text_len = parent->text_len + label_len;
+	memcpy(h->text + e.text, h->text + parent->text, parent->text_len);
+	memcpy(h->text + e.text + parent->text_len, label, label_len);
+	h->text_len += e.text_len;
+    }
+    if (h->count == h->capacity) {
+	size_t capacity = h->capacity == 0 ? 64 : h->capacity * 2;
+	topk_entry *entries = realloc(h->entries, sizeof(topk_entry) * capacity);
+	if (entries == NULL) {
+	    return false;
+	}
+	h->entries = entries;
+	h->capacity = capacity;
+    }
+
+    size_t i = h->count++;
+    while (i > 0 && topk_before(h, &e, &h->entries[(i - 1) / 2])) {
+	h->entries[i] = h->entries[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    h->entries[i] = e;
+    return true;
+}
+
+static topk_entry topk_pop(topk_heap *h)
+{
+    topk_entry top = h->entries[0];
+    topk_entry last = h->entries[--h->count];
+    size_t i = 0;
+    while (2 * i + 1 < h->count) {
+	size_t child = 2 * i + 1;
+	if (child + 1 < h->count && topk_before(h, &h->entries[child + 1], &h->entries[child])) {
+	    child++;
+	}
+	if (!topk_before(h, &h->entries[child], &last)) {
+	    break;
+	}
+	h->entries[i] = h->entries[child];
+	i = child;
+    }
+    h->entries[i] = last;
+    return top;
+}
+
+/*
+ * Higher priority first, then alphabetical order of text. Text of a subtree entry is prefix
+ * of all its words, so it never sorts after them, and a word goes before its own subtree.
+ */
+static bool topk_before(const topk_heap *h, const topk_entry *a, const topk_entry *b)
+{
+    if (a->priority != b->priority) {
+	return a->priority > b->priority;
+    }
+    size_t len = a->text_len < b->text_len ? a->text_len : b->text_len;
+    for (size_t i = 0; i < len; i++) {
+	int a_idx = hash(h->text[a->text + i]);
+	int b_idx = hash(h->text[b->text + i]);
+	if (a_idx != b_idx) {
+	    return a_idx < b_idx;
+	}
+    }
+    if (a->text_len != b->text_len) {
+	return a->text_len < b->text_len;
+    }
+    return a->is_word && !b->is_word;
+}
+
+/*
+ * Passes at most k words within max_edits insertions, deletions or substitutions of given word
+ * to cb, closest first, then by descending score and alphabetically. Trie is walked once with
+ * one edit distance row per char of the path, branches whose row minimum exceeds the bound
+ * are cut. Bound of a subtree shrinks as better words are kept. Returns number of words
+ * passed to cb.
+ */
+size_t suggest(const trie *t, const char *word, unsigned int max_edits, unsigned int k,
+	       completion_cb cb, void *ctx)
+{
+    mapped_word mapped;
+    if (!validate_word(word, &mapped) || k == 0) {
+	return 0;
+    }
+    int slot = reader_enter(t);
+    size_t word_len = mapped.len;
+    size_t max_depth = WALK_CAPACITY(t) - 1;
+    if (word_len + max_edits < max_depth) {
+	max_depth = word_len + max_edits;
+    }
+    suggest_walk w = {
+	.word = word, .slots = mapped.slots, .word_len = word_len, .max_edits = max_edits, .max_depth = max_depth,
+	.k = k, .ok = true
+    };
+    w.rows = malloc(sizeof(unsigned int) * (max_depth + 1) * (word_len + 1));
+    w.path = malloc(max_depth + 1);
+    if (w.rows == NULL || w.path == NULL) {
+	w.ok = false;
+    } else {
+	for (size_t j = 0; j <= word_len; j++) {
+	    w.rows[j] = j;
+	}
+	suggest_node(&w, LOAD_SHARED(t->root), 0, 0);
+    }
+    reader_exit(t, slot);
+    if (!w.ok) {
+	fprintf(stderr, "Memory allocation error\n");
+    }
+
+    size_t emitted = 0;
+    if (w.ok && w.count > 0) {
+	qsort(w.best, w.count, sizeof(suggestion), suggestion_cmp);
+	while (emitted < w.count && cb(w.best[emitted].word, w.best[emitted].len, ctx)) {
+	    emitted++;
+	}
+    }
+    for (size_t i = 0; i < w.count; i++) {
+	free(w.best[i].word);
+    }
+    free(w.best);
+    free(w.path);
+    free(w.rows);
+    return emitted;
+}
+
+/*
+ * Walks subtree of n whose first done label chars are already on the path. Row of the first
+ * char of a child is filled from the key stored in n, so cut children are never loaded.
+ */
+static void suggest_node(suggest_walk *w, const node *n, size_t depth, size_t done)
+{
+    int bound = suggest_bound(w, LOAD_SHARED(n->max_score));
+    if (bound < 0) {
+	return;
+    }
+    for (size_t i = done; i < n->len; i++) {
+	if (depth == w->max_depth) {
+	    return;
+	}
+	w->path[depth++] = n->label[i];
+	if (!suggest_row(w, depth, bound)) {
+	    return;
+	}
+    }
+    // last cell of the row is outside the band if lengths differ by more than bound
+    if (depth + bound >= w->word_len && LOAD_SHARED(n->eow)) {
+	unsigned int distance = w->rows[depth * (w->word_len + 1) + w->word_len];
+	if (distance <= (unsigned int) bound) {
+	    suggest_keep(w, distance, LOAD_SHARED(n->score), depth);
+	}
+    }
+    if (depth == w->max_depth) {
+	return;
+    }
+    // chars missing from the band of the next row give the row of a mismatch, if that row is cut
+    // only children of chars in the band are walked, in slot order without scanning the others
+    w->path[depth] = '\0';
+    if (!suggest_row(w, depth + 1, bound)) {
+	size_t lo = depth + 1 > (size_t) bound ? depth + 1 - bound : 1;
+	size_t hi = depth + 1 + bound < w->word_len ? depth + 1 + bound : w->word_len;
+	int last = -1;
+	for (;;) {
+	    int idx = NUMBER_OF_LETTERS;
+	    for (size_t j = lo; j <= hi; j++) {
+		if (w->slots[j - 1] > last && w->slots[j - 1] < idx) {
+		    idx = w->slots[j - 1];
+		}
+	    }
+	    if (idx == NUMBER_OF_LETTERS) {
+		return;
+	    }
+	    node *child = find_child(n, idx);
+	    if (child != NULL && !suggest_child(w, n, child, idx, depth)) {
+		return;
+	    }
+	    last = idx;
+	}
+    }
+    int pos = 0;
+    node *child;
+    while ((child = next_child(n, &pos)) != NULL) {
+	if (!suggest_child(w, n, child, child_key(n, pos), depth)) {
+	    return;
+	}
+    }
+}
+
+/*
+ * Walks child of n stored at slot idx if its row is within bound. Returns false if no later
+ * child of n needs a walk.
+ */
+static bool suggest_child(suggest_walk *w, const node *n, const node *child, int idx, size_t depth)
+{
+    int bound = suggest_bound(w, LOAD_SHARED(n->max_score));
+    if (bound < 0) {
+	return false;
+    }
+    w->path[depth] = LETTER(idx);
+    if (suggest_row(w, depth + 1, bound)) {
+	suggest_node(w, child, depth + 1, 1);
+    }
+    return w->ok;
+}
+
+/*
+ * Largest distance at which a word of subtree with given best score can still be kept, -1 if
+ * none can. Once k words are kept, a word at the distance of the worst kept one has to score
+ * higher: walk goes in alphabetical order, so it comes after every kept word. Bound never
+ * grows along the path, so rows above stay valid for it.
+ */
+static int suggest_bound(const suggest_walk *w, unsigned int max_score)
+{
+    if (w->count < w->k) {
+	return w->max_edits;
+    }
+    const suggestion *worst = &w->best[0];
+    return max_score > worst->score ? (int) worst->distance : (int) worst->distance - 1;
+}
+
+/*
+ * Fills row for the last char of the path, returns false if no extension of the path
+ * can get within bound. Cells farther than bound from the diagonal can't be within bound,
+ * only the band around it is computed and cells next to the band are capped to bound + 1.
+ */
+static bool suggest_row(suggest_walk *w, size_t depth, unsigned int bound)
+{
+    if (depth > w->word_len + bound) {
+	return false; // path is longer than any word within bound
+    }
+    size_t width = w->word_len + 1;
+    const unsigned int *prev = w->rows + (depth - 1) * width;
+    unsigned int *row = w->rows + depth * width;
+    size_t lo = depth > bound ? depth - bound : 1;
+    size_t hi = depth + bound < w->word_len ? depth + bound : w->word_len;
+    char ch = w->path[depth - 1];
+    row[0] = depth;
+    if (lo > 1) {
+	row[lo - 1] = bound + 1;
+    }
+    if (hi < w->word_len) {
+	row[hi + 1] = bound + 1;
+    }
+    unsigned int min = depth <= bound ? depth : bound + 1;
+    for (size_t j = lo; j <= hi; j++) {
+	unsigned int cost = prev[j - 1] + (w->word[j - 1] != ch);
+	if (prev[j] + 1 < cost) {
+	    cost = prev[j] + 1;
+	}
+	if (row[j - 1] + 1 < cost) {
+	    cost = row[j - 1] + 1;
+	}
+	row[j] = cost;
+	if (cost < min) {
+	    min = cost;
+	}
+    }
+    return min <= bound;
+}
+
+/*
+ * Keeps word on the path if it is better than the worst of k kept words
+ */
+static void suggest_keep(suggest_walk *w, unsigned int distance, unsigned int score, size_t len)
+{
+    suggestion s = { .distance = distance, .score = score, .word = w->path, .len = len };
+    if (w->count == w->k) {
+	if (suggestion_cmp(&s, &w->best[0]) >= 0) {
+	    return;
+	}
+	s.word = w->best[0].word;
+	memcpy(s.word, w->path, len);
+	s.word[len] = '\0';
+	w->best[0] = s;
+	suggest_sift_down(w, 0);
+	return;
+    }
+
+    if (w->count == w->capacity) {
+	size_t capacity = w->capacity == 0 ? 16 : w->capacity * 2;
+	suggestion *best = realloc(w->best, sizeof(suggestion) * capacity);
+	if (best == NULL) {
+	    w->ok = false;
+	    return;
+	}
+	w->best = best;
+	w->capacity = capacity;
+    }
+    char *word = malloc(w->max_depth + 1);
+    if (word == NULL) {
+	w->ok = false;
+	return;
+    }
+    size_t i = w->count++;
+    while (i > 0 && suggestion_cmp(&s, &w->best[(i - 1) / 2]) > 0) {
+	w->best[i] = w->best[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    memcpy(word, w->path, len);
+    word[len] = '\0';
+    s.word = word;
+    w->best[i] = s;
+}
+
+static void suggest_sift_down(suggest_walk *w, size_t i)
+{
+    suggestion s = w->best[i];
+    while (2 * i + 1 < w->count) {
+	size_t child = 2 * i + 1;
+	if (child + 1 < w->count && suggestion_cmp(&w->best[child + 1], &w->best[child]) > 0) {
+	    child++;
+	}
+	if (suggestion_cmp(&w->best[child], &s) <= 0) {
+	    break;
+	}
+	w->best[i] = w->best[child];
+	i = child;
+    }
+    w->best[i] = s;
+}
+
+/*
+ * Orders suggestions from best to worst
+ */
+static int suggestion_cmp(const void *a, const void *b)
+{
+    const suggestion *x = a;
+    const suggestion *y = b;
+    if (x->distance != y->distance) {
+	return x->distance < y->distance ? -1 : 1;
+    }
+    if (x->score != y->score) {
+	return x->score > y->score ? -1 : 1;
+    }
+    size_t len = x->len < y->len ? x->len : y->len;
+    int cmp = memcmp(x->word, y->word, len);
+    if (cmp != 0) {
+	return cmp;
+    }
+    return x->len < y->len ? -1 : x->len > y->len;
+}
+
+/*
+ * Starts paginated completion of given prefix. Returns NULL on invalid word or allocation
+ * failure, cursor without words when nothing starts with the prefix.
+ */
+completion_cursor *complete_begin(const trie *t, const char *word)
+{
+    mapped_word w;
+    if (!validate_word(word, &w)) {
+	return NULL;
+    }
+    completion_cursor *c = calloc(1, sizeof(completion_cursor));
+    if (c == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return NULL;
+    }
+    c->stack_capacity = t->max_len + 1;
+    c->prefix_capacity = t->max_len + 1;
+    c->stack = malloc(sizeof(cursor_frame) * c->stack_capacity);
+    c->prefix = malloc(c->prefix_capacity);
+    if (c->stack == NULL || c->prefix == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	complete_end(c);
+	return NULL;
+    }
+
+    size_t depth;
+    node *n = get_final_node(t->root, &w, &depth);
+    if (n != NULL) {
+	walk_start(c, n, word, depth);
+    }
+    return c;
+}
+
+/*
+ * Passes at most limit next words to cb, in the same order as complete prints them.
+ * Returns number of consumed words, the next call continues right after the last one.
+ */
+size_t complete_next(completion_cursor *c, completion_cb cb, void *ctx, size_t limit)
+{
+    size_t count = 0;
+    while (count < limit) {
+	if (c->pending) {
+	    const cursor_frame *f = &c->stack[c->stack_len - 1];
+	    if (LOAD_SHARED(f->n->eow)) {
+		if (!cb(c->prefix, f->depth + f->n->len, ctx)) {
+		    return count;
+		}
+		count++;
+	    }
+	    c->pending = false;
+	}
+	if (walk_next(c) == NULL) {
+	    break;
+	}
+	c->pending = true;
+    }
+    return count;
+}
+
+/*
+ * Copies at most limit next words into buf as NUL-terminated strings, words[i] points to
+ * the i-th of them. Stops early when buf is full, remaining words stay in the cursor.
+ */
+size_t complete_fill(completion_cursor *c, char *buf, size_t buf_size, char **words, size_t limit)
+{
+    fill_ctx ctx = { .buf = buf, .buf_size = buf_size, .used = 0, .words = words, .count = 0 };
+    return complete_next(c, fill_word, &ctx, limit);
+}
+
+bool complete_done(const completion_cursor *c)
+{
+    return c->stack_len == 0 && !c->pending;
+}
+
+void complete_end(completion_cursor *c)
+{
+    if (c == NULL) {
+	return;
+    }
+    free(c->stack);
+    free(c->prefix);
+    free(c);
+}
+
+/*
+ * Starts keystroke completion session with empty prefix
+ */
+completion_session *session_begin(const trie *t)
+{
+    completion_session *s = malloc(sizeof(completion_session));
+    if (s == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return NULL;
+    }
+    s->t = t;
+    s->steps[0] = (session_step) { .n = t->root, .offset = 0 };
+    s->len = 0;
+    s->matched = 0;
+    return s;
+}
+
+/*
+ * Appends char to prefix, stepping inside the label of the last node or into its child.
+ * Returns false if char is not in the alphabet or prefix is full.
+ */
+bool session_push_char(completion_session *s, char ch)
+{
+    int idx = hash(ch);
+    if (idx == -1 || s->len == MAX_WORD_LEN) {
+	return false;
+    }
+    s->prefix[s->len++] = ch;
+    if (s->matched + 1 < s->len) {
+	return true;
+    }
+    const session_step *last = &s->steps[s->len - 1];
+    if (last->offset < last->n->len) {
+	if (last->n->label[last->offset] == ch) {
+	    s->steps[s->len] = (session_step) { .n = last->n, .offset = last->offset + 1 };
+	    s->matched++;
+	}
+	return true;
+    }
+    node *child = find_child(last->n, idx);
+    if (child != NULL) {
+	s->steps[s->len] = (session_step) { .n = child, .offset = 1 };
+	s->matched++;
+    }
+    return true;
+}
+
+/*
+ * Removes the last char of prefix, returns false if prefix is empty
+ */
+bool session_pop_char(completion_session *s)
+{
+    if (s->len == 0) {
+	return false;
+    }
+    s->len--;
+    if (s->matched > s->len) {
+	s->matched = s->len;
+    }
+    return true;
+}
+
+/*
+ * Passes every word starting with the typed prefix to cb in alphabetical order,
+ * walk starts at the node of the last char
+ */
+void session_complete(const completion_session *s, completion_cb cb, void *ctx)
+{
+    if (s->len == 0 || s->matched < s->len) {
+	return;
+    }
+    const session_step *last = &s->steps[s->len];
+    DECLARE_WALK(c, s->t);
+    walk_start(&c, last->n, s->prefix, s->len - last->offset);
+    complete_next(&c, cb, ctx, SIZE_MAX);
+}
+
+void session_end(completion_session *s)
+{
+    free(s);
+}
+
+/*
+ * Returns number of words starting with prefix, empty prefix matches every word.
+ * Word count of the node holding the last char is read, so cost is bounded by prefix length.
+ */
+size_t count_prefix(const trie *t, const char *prefix)
+{
+    mapped_word w;
+    if (!validate_word(prefix, &w) && w.len > 0) {
+	return 0;
+    }
+    int slot = reader_enter(t);
+    size_t depth;
+    const node *n = get_final_node(LOAD_SHARED(t->root), &w, &depth);
+    size_t count = n != NULL ? LOAD_SHARED(n->words) : 0;
+    reader_exit(t, slot);
+    return count;
+}
+
+/*
+ * Passes the i-th (from 0) word starting with prefix in completion order to cb, empty prefix
+ * matches every word. Descent skips whole subtrees by their word counts, so cost is
+ * bounded by word length times fan-out. Returns false if there are not more than i words.
+ */
+bool select_word(const trie *t, const char *prefix, size_t i, completion_cb cb, void *ctx)
+{
+    mapped_word w;
+    if (!validate_word(prefix, &w) && w.len > 0) {
+	return false;
+    }
+    char word[MAX_WORD_LEN];
+    size_t len;
+    bool found = false;
+    int slot = reader_enter(t);
+    const node *n = get_final_node(LOAD_SHARED(t->root), &w, &len);
+    if (n != NULL && i < LOAD_SHARED(n->words)) {
+	memcpy(word, prefix, len);
+    } else {
+	n = NULL;
+    }
+    while (n != NULL && !found && len + n->len <= MAX_WORD_LEN) {
+	memcpy(word + len, n->label, n->len);
+	len += n->len;
+	if (LOAD_SHARED(n->eow) && i-- == 0) {
+	    found = true;
+	    break;
+	}
+	int pos = 0;
+	const node *child;
+	while ((child = next_child(n, &pos)) != NULL && i >= LOAD_SHARED(child->words)) {
+	    i -= LOAD_SHARED(child->words);
+	}
+	n = child;
+    }
+    reader_exit(t, slot);
+    if (found) {
+	cb(word, len, ctx);
+    }
+    return found;
+}
+
+/*
+ * Returns number of words preceding word in completion order, whether word is in trie or not.
+ * Words of children ordered before the path of word are summed by their counts, so cost is
+ * bounded by word length times fan-out.
+ */
+size_t rank_word(const trie *t, const char *word)
+{
+    mapped_word w;
+    if (!validate_word(word, &w)) {
+	return 0;
+    }
+    size_t rank = 0;
+    int slot = reader_enter(t);
+    const node *n = LOAD_SHARED(t->root);
+    size_t depth = 0;
+    while (n != NULL) {
+	size_t matched = match_label(n, w.chars + depth);
+	if (matched < n->len) {
+	    // subtree precedes word if word diverges with a smaller char, extensions of word follow it
+	    if (depth + matched < w.len && w.slots[depth + matched] > hash(n->label[matched])) {
+		rank += LOAD_SHARED(n->words);
+	    }
+	    break;
+	}
+	depth += n->len;
+	if (depth == w.len) {
+	    break;
+	}
+	if (LOAD_SHARED(n->eow)) {
+	    rank++;
+	}
+	int idx = w.slots[depth];
+	int pos = 0;
+	const node *child;
+	while ((child = next_child(n, &pos)) != NULL && hash(child->label[0]) < idx) {
+	    rank += LOAD_SHARED(child->words);
+	}
+	n = child != NULL && hash(child->label[0]) == idx ? child : NULL;
+    }
+    reader_exit(t, slot);
+    return rank;
+}
+
+/*
+ * Starts walk at n, first depth chars of prefix spell the path above n
+ */
+static void walk_start(completion_cursor *c, const node *n, const char *prefix, size_t depth)
+{
+    c->stack_len = 0;
+    if (depth > 0) {
+	memcpy(c->prefix, prefix, depth);
+    }
+    c->pending = walk_push(c, n, depth);
+}
+
+/*
+ * Advances walk to the next node in pre-order and returns it, NULL when walk is over.
+ * Word of returned node is the first depth + len chars of prefix.
+ */
+static const node *walk_next(completion_cursor *c)
+{
+    while (c->stack_len > 0) {
+	cursor_frame *f = &c->stack[c->stack_len - 1];
+	const node *child = next_child(f->n, &f->pos);
+	if (child == NULL) {
+	    c->stack_len--;
+	} else if (walk_push(c, child, f->depth + f->n->len)) {
+	    return child;
+	} else {
+	    c->stack_len = 0;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Enters n, its label is appended to prefix right after the first depth chars.
+ * Buffers are sized by the longest word, so running out of them means a broken trie.
+ */
+static bool walk_push(completion_cursor *c, const node *n, size_t depth)
+{
+    if (c->stack_len == c->stack_capacity || depth + n->len > c->prefix_capacity) {
+	fprintf(stderr, "Trie is deeper than its longest word\n");
+	return false;
+    }
+    memcpy(c->prefix + depth, n->label, n->len);
+    c->stack[c->stack_len++] = (cursor_frame) { .n = n, .pos = 0, .depth = depth };
+    return true;
+}
+
+/*
+ * Completion callback writing word and newline into FILE passed as ctx
+ */
+bool print_word(const char *word, size_t len, void *ctx)
+{
+    FILE *out = ctx;
+    fwrite(word, 1, len, out);
+    fputc('\n', out);
+    return true;
+}
+
+/*
+ * Passes word to cb of recorder and appends it to recorded text
+ */
+static bool record_word(const char *word, size_t len, void *ctx)
+{
+    word_recorder *r = ctx;
+    if (!r->cb(word, len, r->ctx)) {
+	r->ok = false; // partial result is not stored
+	return false;
+    }
+    if (!r->ok) {
+	return true;
+    }
+    if (r->len + len + 1 > r->limit) {
+	r->ok = false;
+	return true;
+    }
+    if (r->len + len + 1 > r->capacity) {
+	size_t capacity = r->capacity > 0 ? r->capacity * 2 : MAX_WORD_LEN + 1;
+	while (capacity < r->len + len + 1) {
+	    capacity *= 2;
+	}
+	char *text = realloc(r->text, capacity);
+	if (text == NULL) {
+	    r->ok = false;
+	    return true;
+	}
+	r->text = text;
+	r->capacity = capacity;
+    }
+    memcpy(r->text + r->len, word, len);
+    r->text[r->len + len] = '\0';
+    r->len += len + 1;
+    r->count++;
+    return true;
+}
+
+/*
+ * Passes words of cached result to cb until it stops
+ */
+static void replay_words(const cache_entry *e, completion_cb cb, void *ctx)
+{
+    const char *word = e->text;
+    for (size_t i = 0; i < e->count; i++) {
+	size_t len = strlen(word);
+	if (!cb(word, len, ctx)) {
+	    return;
+	}
+	word += len + 1;
+    }
+}
+
+static bool fill_word(const char *word, size_t len, void *ctx)
+{
+    fill_ctx *fill = ctx;
+    if (fill->used + len + 1 > fill->buf_size) {
+	return false;
+    }
+    char *dst = fill->buf + fill->used;
+    memcpy(dst, word, len);
+    dst[len] = '\0';
+    fill->words[fill->count++] = dst;
+    fill->used += len + 1;
+    return true;
+}
+
+#ifdef DEBUG
+void print_trie(const trie *t)
+{
+    DECLARE_WALK(c, t);
+    walk_start(&c, t->root, NULL, 0);
+    complete_next(&c, print_word, stdout, SIZE_MAX);
+}
+#endif
+
+void generate_txt_file(FILE *fp, const trie *t)
+{
+    int slot = reader_enter(t);
+    DECLARE_WALK(c, t);
+    walk_start(&c, LOAD_SHARED(t->root), NULL, 0);
+    complete_next(&c, print_word, fp, SIZE_MAX);
+    reader_exit(t, slot);
+}
+
+/*
+ * Finds node whose label holds the last char of word. Depth receives number of
+ * chars of word spelled by ancestors of returned node.
+ */
+static node *get_final_node(node *n, const mapped_word *w, size_t *depth)
+{
+    *depth = 0;
+    while (n != NULL) {
+	size_t matched = match_label(n, w->chars + *depth);
+	if (*depth + matched == w->len) {
+	    return n;
+	}
+	if (matched < n->len) {
+	    return NULL;
+	}
+	*depth += n->len;
+	n = find_child(n, w->slots[*depth]);
+    }
+    return NULL;
+}
+
+/*
+ * Renders subtree under prefix, or whole trie if prefix is NULL or empty, into svg_out_name.
+ * DOT is streamed into stdin of dot, which keeps rendering after return and is reaped by
+ * SIGCHLD handler, so no intermediate file or zombie is left behind.
+ */
+bool visualize_trie(const trie *t, const char *svg_out_name, const char *prefix, size_t max_depth)
+{
+    if (prefix != NULL && *prefix != '\0' && count_prefix(t, prefix) == 0) {
+	fprintf(stderr, "Prefix doesn't exist\n");
+	return false;
+    }
+    int fd;
+    pid_t pid = spawn_renderer(&fd, svg_out_name);
+    if (pid == -1) {
+	return false;
+    }
+    bool tracked = track_renderer(pid);
+    bool written = false;
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) {
 	fprintf(stderr, "Memory allocation error\n");
-	return NULL;
+	close(fd);
+    } else {
+	/* dot may exit before reading the whole graph, that is reported as write error instead of SIGPIPE */
+	sigset_t pipe_set, old_set;
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+	generate_dot_file(fp, t, prefix, max_depth);
+	written = !ferror(fp);
+	written = fclose(fp) == 0 && written;
+	if (!sigismember(&old_set, SIGPIPE)) {
+	    sigtimedwait(&pipe_set, NULL, &(struct timespec) { 0 });
+	}
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	if (!written) {
+	    fprintf(stderr, "Graph couldn't be passed to %s\n", DOT_LAYOUT_ENGINE);
+	}
+    }
+
+    /* SIGCHLD may have arrived before the renderer was tracked */
+    if (tracked) {
+	reap_renderers(SIGCHLD);
+    } else {
+	waitpid(pid, NULL, 0);
+    }
+    return written;
+}
+
+/*
+ * Writes subtree under prefix as DOT graph. Descendants of a node max_depth levels below the
+ * subtree root (0 for no limit) are drawn as a single node with number of their words. Nodes
+ * are named by their pre-order number, so the same trie always gives the same graph. Returns
+ * number of drawn nodes, 0 if prefix is not in trie.
+ */
+size_t generate_dot_file(FILE *fp, const trie *t, const char *prefix, size_t max_depth)
+{
+    fprintf(fp, "digraph {\n");
+
+    bool whole = prefix == NULL || *prefix == '\0';
+    mapped_word w;
+    int slot = reader_enter(t);
+    const node *n = LOAD_SHARED(t->root);
+    size_t depth = 0;
+    if (!whole) {
+	n = validate_word(prefix, &w) ? get_final_node((node *) n, &w, &depth) : NULL;
+    }
+    size_t drawn = 0;
+    if (n != NULL) {
+	DECLARE_WALK(c, t);
+	size_t ids[WALK_CAPACITY(t)]; // names of nodes on the stack of c
+	walk_start(&c, n, prefix, depth);
+	if (whole) {
+	    write_dot_node(fp, drawn, ROOT_LABEL, strlen(ROOT_LABEL), ROOT_NODE_COLOR);
+	} else {
+	    write_dot_node(fp, drawn, c.prefix, depth + n->len, ROOT_NODE_COLOR);
+	}
+	ids[0] = drawn++;
+	while (drawn < GRAPH_NODE_LIMIT && (n = walk_next(&c)) != NULL) {
+	    size_t level = c.stack_len - 1;
+	    write_dot_node(fp, drawn, n->label, n->len, n->eow ? EOW_CHILD_NODE_COLOR : CHILD_NODE_COLOR);
+	    fprintf(fp, DOT_FILE_EDGE_FORMAT, ids[level - 1], drawn);
+	    ids[level] = drawn++;
+	    if (level == max_depth) {
+		c.stack_len--;
+		if (n->words > n->eow) {
+		    fprintf(fp, DOT_FILE_HIDDEN_NODE_FORMAT, drawn, n->words - n->eow);
+		    fprintf(fp, DOT_FILE_EDGE_FORMAT, ids[level], drawn);
+		    drawn++;
+		}
+	    }
+	}
+	if (drawn >= GRAPH_NODE_LIMIT && walk_next(&c) != NULL) {
+	    fprintf(stderr, "Graph is cut at %d nodes, narrow it with a longer prefix or max depth\n",
+		    GRAPH_NODE_LIMIT);
+	}
+    }
+    reader_exit(t, slot);
+
+    fprintf(fp, "}\n");
+    return drawn;
+}
+
+/*
+ * Writes drawn node of DOT graph, quotes and backslashes of label are escaped since
+ * some alphabets allow them in words
+ */
+static void write_dot_node(FILE *fp, size_t id, const char *label, size_t len, const char *color)
+{
+    fprintf(fp, DOT_FILE_NODE_NAME_FORMAT, id);
+    for (size_t i = 0; i < len; i++) {
+	if (label[i] == '"' || label[i] == '\\') {
+	    fputc('\\', fp);
+	}
+	fputc(label[i], fp);
+    }
+    fprintf(fp, DOT_FILE_NODE_STYLE_FORMAT, color);
+}
+
+/*
+ * Starts dot writing svg_out_name from its stdin, fd receives write end of the pipe.
+ * Returns pid of dot, -1 on failure.
+ */
+static pid_t spawn_renderer(int *fd, const char *svg_out_name)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+	fprintf(stderr, "Pipe couldn't be created\n");
+	return -1;
+    }
+    install_reaper();
+    pid_t pid = fork();
+    if (pid == 0) {
+	/* Other threads may hold locks in the parent, only async-signal-safe calls until exec */
+	if (dup2(fds[0], STDIN_FILENO) != -1) {
+	    execlp(DOT_LAYOUT_ENGINE, DOT_LAYOUT_ENGINE, DOT_GRAPH_FORMAT_FLAG, "-o", svg_out_name, (char *) NULL);
+	}
+	static const char msg[] = DOT_LAYOUT_ENGINE " couldn't be started\n";
+	ssize_t ignored = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	(void) ignored;
+	_exit(127);
+    }
+    close(fds[0]);
+    if (pid == -1) {
+	fprintf(stderr, "Renderer process couldn't be created\n");
+	close(fds[1]);
+	return -1;
+    }
+    *fd = fds[1];
+    return pid;
+}
+
+/*
+ * Keeps pid of renderer for SIGCHLD handler. Returns false if every slot is taken,
+ * such renderer is waited for synchronously.
+ */
+static bool track_renderer(pid_t pid)
+{
+    for (int i = 0; i < MAX_PENDING_RENDERERS; i++) {
+	pid_t free_slot = 0;
+	if (atomic_compare_exchange_strong(&renderers[i], &free_slot, pid)) {
+	    return true;
+	}
+    }
+    return false;
+}
+
+/*
+ * Installs SIGCHLD handler reaping tracked renderers once, unless program already handles SIGCHLD
+ */
+static void install_reaper(void)
+{
+    static atomic_flag installed = ATOMIC_FLAG_INIT;
+    if (atomic_flag_test_and_set(&installed)) {
+	return;
+    }
+    struct sigaction old;
+    struct sigaction sa = { .sa_handler = reap_renderers, .sa_flags = SA_RESTART | SA_NOCLDSTOP };
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, NULL, &old) == 0 && !(old.sa_flags & SA_SIGINFO) && old.sa_handler == SIG_DFL) {
+	sigaction(SIGCHLD, &sa, NULL);
+    }
+}
+
+/*
+ * Reaps finished renderers only, other children of the program are left to it.
+ * Slot of renderer already reaped elsewhere is freed too. Errno of interrupted code is preserved.
+ */
+static void reap_renderers(int sig)
+{
+    (void) sig;
+    int saved_errno = errno;
+    for (int i = 0; i < MAX_PENDING_RENDERERS; i++) {
+	pid_t pid = atomic_load(&renderers[i]);
+	if (pid > 0 && waitpid(pid, NULL, WNOHANG) != 0) {
+	    atomic_compare_exchange_strong(&renderers[i], &pid, 0);
+	}
+    }
+    errno = saved_errno;
+}
+
+/*
+ * Validates word and maps its chars to slots in one pass
+ */
+static bool validate_word(const char *word, mapped_word *w)
+{
+    w->chars = word;
+    w->len = strlen(word);
+    return w->len > 0 && w->len <= MAX_WORD_LEN && map_word(word, w->len, w->slots);
+}
+
+/*
+ * Word of bulk load ends at len, where label matching stops on the first char which is not a letter
+ */
+static bool validate_bulk_word(const bulk_word *bw, mapped_word *w)
+{
+    if (bw->len == 0 || bw->len > MAX_WORD_LEN || IS_VALID_CHAR(bw->word[bw->len])) {
+	return false;
     }
-    n->ch = with;
-    n->children = calloc(NUMBER_OF_LETTERS, sizeof(node *));
-    if (n->children == NULL) {
+    w->chars = bw->word;
+    w->len = bw->len;
+    return map_word(bw->word, bw->len, w->slots);
+}
+
+static node *create_node(trie *t, enum NODE_KIND kind, const char *label, size_t len)
+{
+    node *n = pool_alloc(&t->nodes[kind]);
+    if (n == NULL) {
 	fprintf(stderr, "Memory allocation error\n");
 	return NULL;
     }
+    if (len > 0) {
+	memcpy(n->label, label, len);
+    }
+    n->len = len;
     n->eow = false;
+    n->kind = kind;
+    n->count = 0;
+    n->words = 0;
+    return n;
+}
+
+node *find_child(const node *n, int idx)
+{
+    if (n == NULL || idx < 0) {
+	return NULL;
+    }
+    node **slot = child_slot((node *) n, idx);
+    return slot != NULL ? LOAD_SHARED(*slot) : NULL;
+}
+
+/*
+ * Iterates over present children in slot order, pos should be 0 on first call.
+ * Returns NULL when there are no children left.
+ */
+node *next_child(const node *n, int *pos)
+{
+    switch (n->kind) {
+    case NODE4:
+	return *pos < n->count ? LOAD_SHARED(((const node4 *) n)->children[(*pos)++]) : NULL;
+    case NODE16:
+	return *pos < n->count ? LOAD_SHARED(((const node16 *) n)->children[(*pos)++]) : NULL;
+    default:
+	while (*pos < NUMBER_OF_LETTERS) {
+	    node *child = LOAD_SHARED(((const node_full *) n)->children[(*pos)++]);
+	    if (child != NULL) {
+		return child;
+	    }
+	}
+	return NULL;
+    }
+}
+
+/*
+ * Returns index of the child which next_child returned last with pos
+ */
+static int child_key(const node *n, int pos)
+{
+    switch (n->kind) {
+    case NODE4:
+	return ((const node4 *) n)->keys[pos - 1];
+    case NODE16:
+	return ((const node16 *) n)->keys[pos - 1];
+    default:
+	return pos - 1;
+    }
+}
+
+/*
+ * Returns address of child pointer stored for idx, or NULL if there is no such child
+ */
+static node **child_slot(node *n, int idx)
+{
+    switch (n->kind) {
+    case NODE4: {
+	node4 *n4 = (node4 *) n;
+	for (int i = 0; i < n->count; i++) {
+	    if (n4->keys[i] == idx) {
+		return &n4->children[i];
+	    }
+	}
+	return NULL;
+    }
+    case NODE16: {
+	node16 *n16 = (node16 *) n;
+	int lo = 0, hi = n->count;
+	while (lo < hi) {
+	    int mid = (lo + hi) / 2;
+	    if (n16->keys[mid] < idx) {
+		lo = mid + 1;
+	    } else {
+		hi = mid;
+	    }
+	}
+	return lo < n->count && n16->keys[lo] == idx ? &n16->children[lo] : NULL;
+    }
+    default: {
+	node_full *full = (node_full *) n;
+	return LOAD_SHARED(full->children[idx]) != NULL ? &full->children[idx] : NULL;
+    }
+    }
+}
+
+/*
+ * Inserts child under idx (which must be absent). Full node is grown into the next
+ * layout first, so returned node replaces n in its parent.
+ */
+static node *add_child(trie *t, node *n, int idx, node *child)
+{
+    if (child == NULL) {
+	return n;
+    }
+    if (n->kind != NODE_FULL) {
+	// full node grows into a new one, otherwise keys of published node are shifted in a copy
+	bool full = n->count == (n->kind == NODE4 ? 4 : 16);
+	node *target = full ? resize_node(t, n, n->kind + 1) : writable_node(t, n);
+	if (target == NULL) {
+	    return n;
+	}
+	n = target;
+    }
+    insert_child(n, idx, child);
     return n;
 }
+
+/*
+ * Links child into n in place, n must have room for it
+ */
+static void insert_child(node *n, int idx, node *child)
+{
+    unsigned char *keys;
+    node **children;
+    switch (n->kind) {
+    case NODE4:
+	keys = ((node4 *) n)->keys;
+	children = ((node4 *) n)->children;
+	break;
+    case NODE16:
+	keys = ((node16 *) n)->keys;
+	children = ((node16 *) n)->children;
+	break;
+    default:
+	STORE_SHARED(((node_full *) n)->children[idx], child);
+	n->count++;
+	return;
+    }
+
+    int pos = n->count;
+    while (pos > 0 && keys[pos - 1] > idx) {
+	keys[pos] = keys[pos - 1];
+	children[pos] = children[pos - 1];
+	pos--;
+    }
+    keys[pos] = idx;
+    children[pos] = child;
+    n->count++;
+}
+
+static void remove_child(node *n, int idx)
+{
+    unsigned char *keys;
+    node **children;
+    switch (n->kind) {
+    case NODE4:
+	keys = ((node4 *) n)->keys;
+	children = ((node4 *) n)->children;
+	break;
+    case NODE16:
+	keys = ((node16 *) n)->keys;
+	children = ((node16 *) n)->children;
+	break;
+    default:
+	if (((node_full *) n)->children[idx] != NULL) {
+	    STORE_SHARED(((node_full *) n)->children[idx], NULL);
+	    n->count--;
+	}
+	return;
+    }
+
+    for (int pos = 0; pos < n->count; pos++) {
+	if (keys[pos] == idx) {
+	    memmove(keys + pos, keys + pos + 1, n->count - pos - 1);
+	    memmove(children + pos, children + pos + 1, sizeof(node *) * (n->count - pos - 1));
+	    n->count--;
+	    return;
+	}
+    }
+}
+
+/*
+ * Moves header and children of n into a freshly allocated node of given layout
+ */
+static node *resize_node(trie *t, node *n, enum NODE_KIND kind)
+{
+    node *resized = create_node(t, kind, n->label, n->len);
+    if (resized == NULL) {
+	return NULL;
+    }
+    resized->eow = n->eow;
+    resized->score = n->score;
+    resized->max_score = n->max_score;
+    resized->words = n->words;
+
+    int pos = 0;
+    node *child;
+    while ((child = next_child(n, &pos)) != NULL) {
+	insert_child(resized, hash(child->label[0]), child);
+    }
+    release_node(t, n);
+    return resized;
+}
+
+/*
+ * Moves n into the smallest layout that still fits its children
+ */
+static node *shrink_node(trie *t, node *n)
+{
+    enum NODE_KIND kind = n->count <= 4 ? NODE4 : n->count <= 16 ? NODE16 : NODE_FULL;
+    if (kind >= n->kind) {
+	return n;
+    }
+    node *shrunk = resize_node(t, n, kind);
+    return shrunk != NULL ? shrunk : n;
+}
+
+/*
+ * Folds the only child of a non-word node into it, if both labels fit into one node
+ */
+static node *merge_node(trie *t, node *n)
+{
+    if (n->eow || n->count != 1) {
+	return n;
+    }
+    int pos = 0;
+    node *child = next_child(n, &pos);
+    if (n->len + child->len > MAX_LABEL_LEN) {
+	return n;
+    }
+    child = writable_node(t, child);
+    if (child == NULL) {
+	return n;
+    }
+    memmove(child->label + n->len, child->label, child->len);
+    memcpy(child->label, n->label, n->len);
+    child->len += n->len;
+    release_node(t, n);
+    return child;
+}
+
+static node *compact_node(trie *t, node *n)
+{
+    return shrink_node(t, merge_node(t, n));
+}
@@ -6,68 +6,262 @@
 #define TRIE_H
 
 #include <stdbool.h>
+#include <pthread.h>
+#include "pool.h"
+#include "epoch.h"
+#include "alphabet.h"
+#include "cache.h"
+#include "journal.h"
 
 /*
- * Defines how many deletions needed to rebuild the trie
+ * Longest accepted word, bounds traversal stack and prefix buffer sizes
  */
-#ifdef DEBUG
-#define DELETE_THRESHOLD 5
-#else
-#define DELETE_THRESHOLD 50
-#endif
+#define MAX_WORD_LEN 1024
 
 /*
- * [A-Za-z]
+ * Maximum number of chars of edge label stored inline in a node,
+ * longer single-child chains are spread over several nodes
  */
-#define NUMBER_OF_LETTERS 52
+#define MAX_LABEL_LEN 8
 
 /*
- * Maximum trie size allowed to build graph visualizer
+ * Maximum trie size rendered after every mutation in DEBUG builds
  */
 #define GRAPH_VISUALIZER_LIMIT 30
 
+/*
+ * Maximum number of nodes drawn by graph visualizer, larger subtrees are cut
+ */
+#define GRAPH_NODE_LIMIT 5000
+
+/*
+ * Number of buckets of depth histogram in trie_stats, deeper nodes are counted in the last one
+ */
+#define STATS_DEPTH_BUCKETS 32
+
+/*
+ * Node layouts, chosen by fan-out. Small nodes keep children in sorted key arrays,
+ * NODE_FULL indexes children directly by slot of the alphabet.
+ */
+enum NODE_KIND {
+    NODE4, NODE16, NODE_FULL, NODE_KINDS
+};
+
+/*
+ * Header shared by every node layout
+ */
 typedef struct node
 {
-    char ch;
-    struct node **children;
     bool eow; // end of word
+    unsigned char kind;
+    unsigned char count; // number of children
+    unsigned char len; // label length, 0 only for root
+    char label[MAX_LABEL_LEN]; // compressed edge from parent, first char selects the slot
+    unsigned int score; // score of the word ending here
+    unsigned int max_score; // best score in subtree, bound for top-k search
+    unsigned int words; // number of words in subtree, own word included
 } node;
 
+typedef struct
+{
+    node n;
+    unsigned char keys[4];
+    node *children[4];
+} node4;
+
+typedef struct
+{
+    node n;
+    unsigned char keys[16];
+    node *children[16];
+} node16;
+
+typedef struct
+{
+    node n;
+    node *children[NUMBER_OF_LETTERS];
+} node_full;
+
+/*
+ * Receives completed word (not NUL-terminated) and its length.
+ * Returning false stops completion before the word is consumed.
+ */
+typedef bool (*completion_cb)(const char *word, size_t len, void *ctx);
+
+typedef struct
+{
+    const node *n;
+    int pos; // next_child position of the next child to visit
+    size_t depth; // prefix length before label of n
+} cursor_frame;
+
+/*
+ * Resumable iterative depth-first walk, holds the path to the next node to visit.
+ * Stack and prefix buffer are sized by the longest word of trie up front, so walking never
+ * allocates. Cursor is invalidated by any mutation of its trie.
+ */
+typedef struct
+{
+    cursor_frame *stack;
+    size_t stack_len;
+    size_t stack_capacity;
+    char *prefix;
+    size_t prefix_capacity;
+    bool pending; // node on top of the stack is entered but its word is not emitted yet
+} completion_cursor;
+
+/*
+ * Word of bulk load, score is applied only if scored is set. Word is not NUL terminated,
+ * it may point into a mapped file, but char following it must not be a letter.
+ */
+typedef struct
+{
+    const char *word;
+    size_t len;
+    unsigned int score;
+    bool scored;
+} bulk_word;
+
+/*
+ * Shape and memory footprint of a trie, filled by collect_stats
+ */
+typedef struct
+{
+    size_t words;
+    size_t nodes; // root included
+    size_t nodes_by_kind[NODE_KINDS];
+    size_t node_bytes; // bytes of reachable nodes, inline child arrays included
+    size_t reserved_bytes; // bytes of node pools, free and not yet carved slots included
+    size_t label_chars;
+    size_t dead_nodes; // nodes without words below them, deletion is expected to prune them
+    size_t mergeable_nodes; // non-word nodes whose only child would fit into their label
+    size_t max_depth; // in nodes below root
+    size_t depth_histogram[STATS_DEPTH_BUCKETS]; // nodes by number of nodes above them
+    size_t fanout_histogram[NUMBER_OF_LETTERS + 1]; // nodes by number of children
+    size_t cache_entries; // completion cache, all zero unless enabled
+    size_t cache_bytes;
+    size_t cache_hits;
+    size_t cache_misses;
+} trie_stats;
+
 typedef struct
 {
     node *root;
     unsigned int size;
-    unsigned int delete_threshold;
+    size_t max_len; // longest word inserted since creation or reset
+    pool nodes[NODE_KINDS]; // arena per node layout
+    epoch_domain *epoch; // reclamation of unlinked nodes in concurrent mode, NULL otherwise
+    pthread_mutex_t writer; // serializes mutations in concurrent mode
+    completion_cache *cache; // results of complete by prefix, NULL unless enabled
+    journal *journal; // log of mutations, NULL unless enabled
 } trie;
 
+/*
+ * Position after a typed char, the char is label[offset - 1] of n
+ */
+typedef struct
+{
+    const node *n;
+    size_t offset;
+} session_step;
+
+/*
+ * Prefix typed one char at a time. Step of every typed char is kept, so adding or removing
+ * a char costs a single child lookup and completion starts at the last node right away.
+ * Session is invalidated by any mutation of its trie.
+ */
+typedef struct
+{
+    const trie *t;
+    char prefix[MAX_WORD_LEN];
+    session_step steps[MAX_WORD_LEN + 1]; // steps[i] follows the first i chars, steps[0] is root
+    size_t len;
+    size_t matched; // leading chars of prefix spelled by trie, further chars have no step
+} completion_session;
+
 trie *create_trie();
 
 void free_trie(trie *t);
 
+bool enable_concurrent_mode(trie *t);
+
+bool enable_completion_cache(trie *t, size_t max_bytes);
+
+bool enable_journal(trie *t, const char *path);
+
+bool sync_journal(trie *t);
+
+bool compact_journal(trie *t);
+
 bool put(trie *t, const char *word);
 
+bool put_scored(trie *t, const char *word, unsigned int score);
+
+unsigned int put_parallel(trie *t, const bulk_word *words, size_t count, unsigned int threads);
+
+unsigned int put_sorted(trie *t, const bulk_word *words, size_t count);
+
 bool delete(trie *t, const char *word);
 
 bool check(const trie *t, const char *word);
 
-void complete(const trie *t, const char *word);
+void complete(const trie *t, const char *word, completion_cb cb, void *ctx);
+
+void complete_topk(const trie *t, const char *word, unsigned int k, completion_cb cb, void *ctx);
+
+size_t suggest(const trie *t, const char *word, unsigned int max_edits, unsigned int k,
+	       completion_cb cb, void *ctx);
+
+completion_cursor *complete_begin(const trie *t, const char *word);
+
+size_t complete_next(completion_cursor *c, completion_cb cb, void *ctx, size_t limit);
+
+size_t complete_fill(completion_cursor *c, char *buf, size_t buf_size, char **words, size_t limit);
+
+bool complete_done(const completion_cursor *c);
+
+void complete_end(completion_cursor *c);
+
+completion_session *session_begin(const trie *t);
+
+bool session_push_char(completion_session *s, char ch);
+
+bool session_pop_char(completion_session *s);
+
+void session_complete(const completion_session *s, completion_cb cb, void *ctx);
+
+void session_end(completion_session *s);
+
+size_t count_prefix(const trie *t, const char *prefix);
+
+bool select_word(const trie *t, const char *prefix, size_t i, completion_cb cb, void *ctx);
+
+size_t rank_word(const trie *t, const char *word);
 
 void reset_trie(trie *t);
 
+void release_words(trie *t);
+
+void collect_stats(trie *t, trie_stats *s);
+
 #ifdef DEBUG
 void print_trie(const trie *t);
 #endif
 
 void generate_txt_file(FILE *fp, const trie *t);
 
-void generate_dot_file(FILE *fp, const trie *t);
+size_t generate_dot_file(FILE *fp, const trie *t, const char *prefix, size_t max_depth);
 
-void visualize_trie(FILE *dot_fp, char *dot_out_name, char *svg_out_name, const trie *t);
+bool visualize_trie(const trie *t, const char *svg_out_name, const char *prefix, size_t max_depth);
 
 #ifdef DEBUG
 void visualize_trie_debug(const trie *t);
 #endif
 
-int hash(char ch);
+bool print_word(const char *word, size_t len, void *ctx);
+
+node *find_child(const node *n, int idx);
+
+node *next_child(const node *n, int *pos);
 
 #endif // TRIE_H
@@ -3,16 +3,92 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "trie.h"
 #include "repl.h"
+#include "server.h"
+
+/*
+ * Size of stdout buffer in batch mode
+ */
+#define BATCH_OUTPUT_BUFFER_SIZE (1 << 20)
+
+#define USAGE "Usage: fcmpl [--cache <MiB>] [--journal <file>] [--batch [--nul | --length]]\n" \
+    "       fcmpl [--cache <MiB>] [--journal <file>] --serve <socket> [dictionary]\n"
+
+static int run_interactive(trie *t);
+static int run_batch(trie *t);
+static bool load_dictionary(trie *t, const char *dictionary);
+static void sync_on_exit(void);
+
+/*
+ * Trie whose journal is synced when REPL exits on end of input
+ */
+static trie *journaled = NULL;
+
+int main(int argc, char **argv) {
+    bool batch = false;
+    enum OUTPUT_FORMAT format = OUTPUT_NEWLINE;
+    const char *socket_path = NULL;
+    const char *dictionary = NULL;
+    const char *journal_path = NULL;
+    unsigned long cache_mib = 0;
+    for (int i = 1; i < argc; i++) {
+	char *end;
+	if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc && cache_mib == 0 &&
+	    (cache_mib = strtoul(argv[i + 1], &end, 10)) > 0 && *end == '\0') {
+	    i++;
+	} else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc && journal_path == NULL) {
+	    journal_path = argv[++i];
+	} else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc && socket_path == NULL) {
+	    socket_path = argv[++i];
+	} else if (socket_path != NULL && dictionary == NULL && argv[i][0] != '-') {
+	    dictionary = argv[i];
+	} else if (strcmp(argv[i], "--batch") == 0) {
+	    batch = true;
+	} else if (strcmp(argv[i], "--nul") == 0) {
+	    format = OUTPUT_NUL;
+	} else if (strcmp(argv[i], "--length") == 0) {
+	    format = OUTPUT_LENGTH;
+	} else {
+	    fprintf(stderr, USAGE);
+	    return 1;
+	}
+    }
+    if ((!batch && format != OUTPUT_NEWLINE) || (batch && socket_path != NULL)) {
+	fprintf(stderr, USAGE);
+	return 1;
+    }
 
-int main(void) {
     trie *t = create_trie();
     if (t == NULL) {
 	fprintf(stderr, "REPL couldn't be initialized\n");
 	return 1;
     }
+    if (cache_mib > 0 && !enable_completion_cache(t, (size_t) cache_mib << 20)) {
+	free_trie(t);
+	return 1;
+    }
+    // journal is replayed over the dictionary, so words deleted from it stay deleted
+    if ((dictionary != NULL && !load_dictionary(t, dictionary)) ||
+	(journal_path != NULL && !enable_journal(t, journal_path))) {
+	free_trie(t);
+	return 1;
+    }
+    journaled = t;
+    atexit(sync_on_exit);
+
+    set_output_format(format);
+    int status = socket_path != NULL ? serve(t, socket_path) :
+	batch ? run_batch(t) : run_interactive(t);
+    journaled = NULL;
+    free_trie(t);
+    return status;
+}
 
+static int run_interactive(trie *t)
+{
     bool termination = false;
 
     do {
@@ -22,6 +98,7 @@ int main(void) {
 
 	if (tokens == NULL) {
 	    fprintf(stderr, "Bad command\n");
+	    free(line);
 	    continue;
 	}
 
@@ -30,8 +107,40 @@ int main(void) {
 	FREE_INPUT(tokens, line);
     } while (!termination);
 
-    free_trie(t);
-
     printf("Have a good day!\n");
     return 0;
 }
+
+/*
+ * Runs commands read from stdin, output is written in large blocks
+ */
+static int run_batch(trie *t)
+{
+    setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER_SIZE);
+    if (!execute_batch(t, stdin)) {
+	return 1;
+    }
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+static bool load_dictionary(trie *t, const char *dictionary)
+{
+    FILE *fp = fopen(dictionary, "r");
+    if (fp == NULL) {
+	fprintf(stderr, "File couldn't be opened\n");
+	return false;
+    }
+    build_trie(fp, t, false);
+    fclose(fp);
+    return true;
+}
+
+/*
+ * REPL exits right away on end of input, mutations still in journal buffer are written first
+ */
+static void sync_on_exit(void)
+{
+    if (journaled != NULL) {
+	sync_journal(journaled);
+    }
+}
@@ -8,7 +8,11 @@
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "repl.h"
+#include "dawg.h"
 #include "graphviz_cfg.h"
 
 #define BUFFER_SIZE 256
@@ -21,7 +25,27 @@
 /*
  * Maximum size of tokens in repl command
  */
-#define MAX_TOKEN_SIZE 2
+#define MAX_TOKEN_SIZE 4
+
+/*
+ * Option of .load for files sorted in ascending byte order
+ */
+#define LOAD_SORTED_OPTION "--sorted"
+
+/*
+ * Prefix of .visualize standing for the whole trie, so max depth can be given without prefix
+ */
+#define VISUALIZE_ROOT_OPTION "."
+
+/*
+ * Number of completions printed by .top when count is not provided
+ */
+#define TOPK_DEFAULT 10
+
+/*
+ * Number of edits allowed by .suggest when it is not provided
+ */
+#define SUGGEST_DEFAULT_EDITS 2
 
 #define COMMAND_STRNCMP_LEN(str) (strlen(str) + 1)
 
@@ -39,14 +63,20 @@ enum REPL_COMMAND {
     DELETE,
     /* Checks whether word exists */
     CHECK,
-    /* Loads list of valid words from file (separated by newline) */
+    /* Loads list of valid words from file (separated by newline), optionally sorted */
     LOAD,
     /* Resets trie (removes all nodes except root)*/
     RESET,
     /* Generates file from word tree (reverse process of load) */
     GENERATE,
-    /* Visualizes word tree with graph (svg and dot file) */
+    /* Visualizes subtree of prefix with svg graph */
     VISUALIZE,
+    /* Freezes word tree into read-only minimal DAWG */
+    FREEZE,
+    /* Saves frozen dictionary into binary snapshot file */
+    SAVE,
+    /* Maps binary snapshot file as read-only dictionary */
+    OPEN,
     /* Cleans terminal screen */
     CLEAN,
     /* Terminates REPL */
@@ -55,6 +85,16 @@ enum REPL_COMMAND {
     /* Prints tree in readable format (for debugging) */
     PRINT,
 #endif
+    /* Completes given word with best scored words only */
+    TOP,
+    /* Suggests corrections of given word within few edits */
+    SUGGEST,
+    /* Prints shape and memory footprint of word tree */
+    STATS,
+    /* Starts keystroke completion session, following lines are typed chars until .end */
+    SESSION,
+    /* Counts words with given prefix or lists them from given offset */
+    COUNT,
     /* Assumes that input is not special command and completes given word */
     COMPLETION
 };
@@ -66,13 +106,50 @@ static bool repl_load(trie *t, char **tokens);
 static bool repl_visualize(trie *t, char **tokens);
 static bool repl_generate(trie *t, char **tokens);
 static bool repl_complete(trie *t, char **tokens);
+static bool repl_top(trie *t, char **tokens);
+static bool repl_suggest(trie *t, char **tokens);
+static bool repl_stats(trie *t);
+static bool repl_session(trie *t);
+static bool repl_session_keys(trie *t, char **tokens);
+static bool repl_count(trie *t, char **tokens);
+static void print_histogram(const char *name, const size_t *buckets, size_t count, bool open_ended);
+static bool emit_word(const char *word, size_t len, void *ctx);
+static bool valid_arguments(enum REPL_COMMAND command, char **tokens);
 static bool repl_reset_trie(trie *t);
-static void build_trie(FILE *fp, trie *t);
+static bool repl_freeze(trie *t);
+static bool repl_frozen();
+static bool repl_save(trie *t, char **tokens);
+static bool repl_open(trie *t, char **tokens);
+static char *read_file(FILE *fp, size_t *len);
+static bool scan_words(const char *text, size_t len, bulk_word **words, size_t *count, size_t *capacity);
+static bool parse_word_line(const char *line, const char *eol, bulk_word *bw);
 static enum REPL_COMMAND get_command(const char *token);
 
+/*
+ * Read-only form of the dictionary, set after .freeze or .open until .reset
+ */
+static dawg *frozen = NULL;
+
+/*
+ * Keystroke completion session, set by .session until .end
+ */
+static completion_session *session = NULL;
+
+/*
+ * Framing of words printed by commands, set once at startup
+ */
+static enum OUTPUT_FORMAT output_format = OUTPUT_NEWLINE;
+
 bool execute(trie *t, char **tokens)
 {
+    if (session != NULL) {
+	return repl_session_keys(t, tokens);
+    }
     enum REPL_COMMAND command = get_command(*tokens);
+    if (!valid_arguments(command, tokens)) {
+	fprintf(stderr, "Bad command\n");
+	return false;
+    }
 
     switch (command) {
     case ADD:
@@ -89,6 +166,22 @@ bool execute(trie *t, char **tokens)
 	return repl_visualize(t, tokens);
     case GENERATE:
 	return repl_generate(t, tokens);
+    case FREEZE:
+	return repl_freeze(t);
+    case SAVE:
+	return repl_save(t, tokens);
+    case TOP:
+	return repl_top(t, tokens);
+    case SUGGEST:
+	return repl_suggest(t, tokens);
+    case STATS:
+	return repl_stats(t);
+    case SESSION:
+	return repl_session(t);
+    case COUNT:
+	return repl_count(t, tokens);
+    case OPEN:
+	return repl_open(t, tokens);
 #ifdef DEBUG
     case PRINT:
 	print_trie(t);
@@ -98,6 +191,8 @@ bool execute(trie *t, char **tokens)
 	system("clear");
 	return false;
     case QUIT:
+	free_dawg(frozen);
+	frozen = NULL;
 	return true;
     default:
 	return repl_complete(t, tokens);
@@ -153,16 +248,18 @@ char **parse_line(char *line)
 
     token = strtok(line, COMMAND_DELIM);
     if (token == NULL) {
-	FREE_INPUT(tokens, line);
+	free(tokens);
 	return NULL;
     }
     tokens[0] = token;
 
-    token = strtok(NULL, COMMAND_DELIM);
-    tokens[1] = token;
+    for (int i = 1; i < MAX_TOKEN_SIZE; i++) {
+	token = strtok(NULL, COMMAND_DELIM);
+	tokens[i] = token;
+    }
 
     if (strtok(NULL, COMMAND_DELIM) != NULL) {
-	FREE_INPUT(tokens, line);
+	free(tokens);
 	return NULL;
     }
 
@@ -176,6 +273,9 @@ static bool repl_add(trie *t, char **tokens)
 	fprintf(stderr, "Word is not provided\n");
 	return false;
     }
+    if (repl_frozen()) {
+	return false;
+    }
     if (!put(t, word)) {
 	fprintf(stderr, "Invalid word\n");
     }
@@ -194,6 +294,9 @@ static bool repl_delete(trie *t, char **tokens)
 	fprintf(stderr, "Word is not provided\n");
 	return false;
     }
+    if (repl_frozen()) {
+	return false;
+    }
     if (!delete(t, word)) {
 	fprintf(stderr, "Word doesn't exist\n");
     }
@@ -212,8 +315,8 @@ static bool repl_check(trie *t, char **tokens)
 	fprintf(stderr, "Word is not provided\n");
 	return false;
     }
-    if (check(t, word)) {
-	printf("%s\n", word);
+    if (frozen != NULL ? dawg_check(frozen, word) : check(t, word)) {
+	emit_word(word, strlen(word), NULL);
     }
     return false;
 }
@@ -221,16 +324,27 @@ static bool repl_check(trie *t, char **tokens)
 static bool repl_load(trie *t, char **tokens)
 {
     char *file_name = *(tokens + 1);
+    bool sorted = false;
+    if (file_name != NULL && strcmp(file_name, LOAD_SORTED_OPTION) == 0) {
+	sorted = true;
+	file_name = *(tokens + 2);
+    } else if (*(tokens + 2) != NULL) {
+	fprintf(stderr, "Bad command\n");
+	return false;
+    }
     if (file_name == NULL) {
 	fprintf(stderr, "File name not provided\n");
 	return false;
     }
+    if (repl_frozen()) {
+	return false;
+    }
     FILE *fp = fopen(file_name, "r");
     if (fp == NULL) {
 	fprintf(stderr, "File couldn't be opened\n");
 	return false;
     }
-    build_trie(fp, t);
+    build_trie(fp, t, sorted);
     fclose(fp);
     return false;
 }
@@ -242,21 +356,27 @@ static bool repl_visualize(trie *t, char **tokens)
 	fprintf(stderr, "Output file name not provided\n");
 	return false;
     }
-
-    char dot_out_name[strlen(out_name) + FILE_EXTENSION_LEN];
-    GENERATE_FILE_NAME(dot_out_name, out_name, ".dot");
+    if (repl_frozen()) {
+	return false;
+    }
+    char *prefix = *(tokens + 2);
+    if (prefix != NULL && strcmp(prefix, VISUALIZE_ROOT_OPTION) == 0) {
+	prefix = NULL;
+    }
+    size_t max_depth = 0;
+    if (*(tokens + 3) != NULL) {
+	char *end;
+	max_depth = strtoul(*(tokens + 3), &end, 10);
+	if (*end != '\0') {
+	    fprintf(stderr, "Invalid depth\n");
+	    return false;
+	}
+    }
 
     char svg_out_name[strlen(out_name) + FILE_EXTENSION_LEN];
     GENERATE_FILE_NAME(svg_out_name, out_name, ".svg");
 
-    FILE *dot_fp = fopen(dot_out_name, "w");
-    if (dot_fp == NULL) {
-	fprintf(stderr, "File couldn't be opened\n");
-	return false;
-    }
-
-    visualize_trie(dot_fp, dot_out_name, svg_out_name, t);
-    fclose(dot_fp);
+    visualize_trie(t, svg_out_name, prefix, max_depth);
 
     return false;
 }
@@ -273,7 +393,11 @@ static bool repl_generate(trie *t, char **tokens)
     GENERATE_FILE_NAME(txt_name, out_name, ".txt");
 
     FILE *txt_fp = fopen(txt_name, "w");
-    generate_txt_file(txt_fp, t);
+    if (frozen != NULL) {
+	generate_dawg_txt_file(txt_fp, frozen);
+    } else {
+	generate_txt_file(txt_fp, t);
+    }
     fclose(txt_fp);
 
     return false;
@@ -285,12 +409,309 @@ static bool repl_complete(trie *t, char **tokens)
 	fprintf(stderr, "More than one word provided\n");
 	return false;
     }
-    complete(t, *tokens);
+    if (frozen != NULL) {
+	dawg_complete(frozen, *tokens, emit_word, NULL);
+    } else {
+	complete(t, *tokens, emit_word, NULL);
+    }
+    return false;
+}
+
+static bool repl_top(trie *t, char **tokens)
+{
+    char *word = *(tokens + 1);
+    if (word == NULL) {
+	fprintf(stderr, "Word is not provided\n");
+	return false;
+    }
+    unsigned int k = TOPK_DEFAULT;
+    if (*(tokens + 2) != NULL) {
+	char *end;
+	k = strtoul(*(tokens + 2), &end, 10);
+	if (*end != '\0') {
+	    fprintf(stderr, "Invalid count\n");
+	    return false;
+	}
+    }
+    if (repl_frozen()) {
+	return false;
+    }
+    complete_topk(t, word, k, emit_word, NULL);
+    return false;
+}
+
+static bool repl_suggest(trie *t, char **tokens)
+{
+    char *word = *(tokens + 1);
+    if (word == NULL) {
+	fprintf(stderr, "Word is not provided\n");
+	return false;
+    }
+    unsigned int max_edits = SUGGEST_DEFAULT_EDITS;
+    if (*(tokens + 2) != NULL) {
+	char *end;
+	max_edits = strtoul(*(tokens + 2), &end, 10);
+	if (*end != '\0') {
+	    fprintf(stderr, "Invalid edit count\n");
+	    return false;
+	}
+    }
+    if (repl_frozen()) {
+	return false;
+    }
+    suggest(t, word, max_edits, TOPK_DEFAULT, emit_word, NULL);
     return false;
 }
 
+static bool repl_stats(trie *t)
+{
+    if (repl_frozen()) {
+	return false;
+    }
+    trie_stats s;
+    collect_stats(t, &s);
+    double words = s.words > 0 ? s.words : 1;
+    printf("words: %zu\n", s.words);
+    printf("nodes: %zu (node4 %zu, node16 %zu, node_full %zu)\n", s.nodes,
+	   s.nodes_by_kind[NODE4], s.nodes_by_kind[NODE16], s.nodes_by_kind[NODE_FULL]);
+    printf("node bytes: %zu (%.1f per word)\n", s.node_bytes, s.node_bytes / words);
+    printf("reserved bytes: %zu (%.1f per word)\n", s.reserved_bytes, s.reserved_bytes / words);
+    printf("label chars: %zu (%.2f per node)\n", s.label_chars, (double) s.label_chars / s.nodes);
+    printf("dead nodes: %zu\n", s.dead_nodes);
+    printf("mergeable nodes: %zu\n", s.mergeable_nodes);
+    printf("max depth: %zu\n", s.max_depth);
+    print_histogram("depth", s.depth_histogram, STATS_DEPTH_BUCKETS, true);
+    print_histogram("fan-out", s.fanout_histogram, NUMBER_OF_LETTERS + 1, false);
+    if (t->cache != NULL) {
+	printf("cache: %zu entries, %zu bytes, %zu hits, %zu misses\n", s.cache_entries,
+	       s.cache_bytes, s.cache_hits, s.cache_misses);
+    }
+    return false;
+}
+
+static bool repl_session(trie *t)
+{
+    if (repl_frozen()) {
+	return false;
+    }
+    session = session_begin(t);
+    return false;
+}
+
+/*
+ * Line of session mode: chars typed at the end of prefix, ".pop [count]" removing last chars,
+ * ".end" leaving the mode or ".quit". Completions of the prefix are printed after each line.
+ */
+static bool repl_session_keys(trie *t, char **tokens)
+{
+    if (strcmp(*tokens, ".end") == 0 || strcmp(*tokens, ".quit") == 0) {
+	session_end(session);
+	session = NULL;
+	return strcmp(*tokens, ".quit") == 0 ? execute(t, tokens) : false;
+    }
+    if (strcmp(*tokens, ".pop") == 0 && *(tokens + 2) == NULL) {
+	unsigned long count = 1;
+	if (*(tokens + 1) != NULL) {
+	    char *end;
+	    count = strtoul(*(tokens + 1), &end, 10);
+	    if (*end != '\0') {
+		fprintf(stderr, "Invalid count\n");
+		return false;
+	    }
+	}
+	while (count-- > 0 && session_pop_char(session)) {
+	}
+    } else if (**tokens == '.' || *(tokens + 1) != NULL) {
+	fprintf(stderr, "Bad command\n");
+	return false;
+    } else {
+	for (const char *ch = *tokens; *ch != '\0'; ch++) {
+	    if (!session_push_char(session, *ch)) {
+		fprintf(stderr, "Invalid char\n");
+		break;
+	    }
+	}
+    }
+    session_complete(session, emit_word, NULL);
+    return false;
+}
+
+/*
+ * Prints number of words with prefix, or with offset up to TOPK_DEFAULT of them
+ * starting at that position of completion order
+ */
+static bool repl_count(trie *t, char **tokens)
+{
+    char *prefix = *(tokens + 1);
+    if (prefix == NULL) {
+	fprintf(stderr, "Prefix is not provided\n");
+	return false;
+    }
+    if (repl_frozen()) {
+	return false;
+    }
+    if (*(tokens + 2) == NULL) {
+	printf("%zu\n", count_prefix(t, prefix));
+	return false;
+    }
+    char *end;
+    size_t offset = strtoul(*(tokens + 2), &end, 10);
+    if (*end != '\0') {
+	fprintf(stderr, "Invalid offset\n");
+	return false;
+    }
+    for (size_t i = offset; i < offset + TOPK_DEFAULT && select_word(t, prefix, i, emit_word, NULL); i++) {
+    }
+    return false;
+}
+
+/*
+ * Prints non-empty buckets, last bucket of open-ended histogram holds larger values too
+ */
+static void print_histogram(const char *name, const size_t *buckets, size_t count, bool open_ended)
+{
+    printf("%s histogram:\n", name);
+    for (size_t i = 0; i < count; i++) {
+	if (buckets[i] > 0) {
+	    printf("  %zu%s: %zu\n", i, open_ended && i == count - 1 ? "+" : "", buckets[i]);
+	}
+    }
+}
+
+void set_output_format(enum OUTPUT_FORMAT format)
+{
+    output_format = format;
+}
+
+/*
+ * Writes word to stdout framed by output format
+ */
+static bool emit_word(const char *word, size_t len, void *ctx)
+{
+    (void) ctx;
+    switch (output_format) {
+    case OUTPUT_NUL:
+	fwrite(word, 1, len, stdout);
+	putchar('\0');
+	break;
+    case OUTPUT_LENGTH: {
+	unsigned char prefix[4] = { len & 0xFF, (len >> 8) & 0xFF, (len >> 16) & 0xFF, (len >> 24) & 0xFF };
+	fwrite(prefix, 1, sizeof(prefix), stdout);
+	fwrite(word, 1, len, stdout);
+	break;
+    }
+    default:
+	fwrite(word, 1, len, stdout);
+	putchar('\n');
+    }
+    return true;
+}
+
+/*
+ * Writes empty word, which ends output of a batch command
+ */
+void end_output_record()
+{
+    emit_word("", 0, NULL);
+}
+
+bool batch_reader_init(batch_reader *r, FILE *fp)
+{
+    // a partial line of the previous block and the next block fit without growing
+    size_t capacity = 2 * BATCH_BLOCK_SIZE;
+    *r = (batch_reader) { .fp = fp, .buf = malloc(capacity), .capacity = capacity };
+    if (r->buf == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return false;
+    }
+    return true;
+}
+
+/*
+ * Returns next line without newline, NUL-terminated in place. Line stays valid until
+ * the next call. Returns NULL at the end of input.
+ */
+char *batch_next_line(batch_reader *r)
+{
+    while (true) {
+	char *line = r->buf + r->start;
+	char *eol = memchr(line, '\n', r->end - r->start);
+	if (eol != NULL) {
+	    *eol = '\0';
+	    r->start = eol - r->buf + 1;
+	    return line;
+	}
+	if (r->eof) {
+	    if (r->start == r->end) {
+		return NULL;
+	    }
+	    // last line without newline, room for terminator is kept by the reads below
+	    r->buf[r->end] = '\0';
+	    r->start = r->end;
+	    return line;
+	}
+
+	// moves partial line to the front and reads the next block after it
+	memmove(r->buf, line, r->end - r->start);
+	r->end -= r->start;
+	r->start = 0;
+	if (r->capacity - r->end < BATCH_BLOCK_SIZE + 1) {
+	    size_t capacity = r->capacity * 2;
+	    char *buf = realloc(r->buf, capacity);
+	    if (buf == NULL) {
+		fprintf(stderr, "Memory allocation error\n");
+		return NULL;
+	    }
+	    r->buf = buf;
+	    r->capacity = capacity;
+	}
+	size_t read = fread(r->buf + r->end, 1, BATCH_BLOCK_SIZE, r->fp);
+	r->end += read;
+	r->eof = read < BATCH_BLOCK_SIZE;
+    }
+}
+
+void batch_reader_free(batch_reader *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/*
+ * Runs commands read from fp without prompts. Output of every line, even an empty one,
+ * ends with an empty word, so results can be matched to input lines. Returns false if
+ * reader couldn't be allocated.
+ */
+bool execute_batch(trie *t, FILE *fp)
+{
+    batch_reader r;
+    if (!batch_reader_init(&r, fp)) {
+	return false;
+    }
+
+    bool termination = false;
+    char *line;
+    while (!termination && (line = batch_next_line(&r)) != NULL) {
+	char **tokens = parse_line(line);
+	if (tokens == NULL) {
+	    if (*line != '\0') {
+		fprintf(stderr, "Bad command\n");
+	    }
+	} else {
+	    termination = execute(t, tokens);
+	    free(tokens);
+	}
+	end_output_record();
+    }
+
+    batch_reader_free(&r);
+    return true;
+}
+
 static bool repl_reset_trie(trie *t)
 {
+    free_dawg(frozen);
+    frozen = NULL;
     reset_trie(t);
 #ifdef DEBUG
     visualize_trie_debug(t);
@@ -298,34 +719,250 @@ static bool repl_reset_trie(trie *t)
     return false;
 }
 
-static void build_trie(FILE *fp, trie *t)
+/*
+ * Replaces mutable trie with its minimal DAWG, trie memory is released
+ */
+static bool repl_freeze(trie *t)
+{
+    if (repl_frozen()) {
+	return false;
+    }
+    frozen = freeze(t);
+    if (frozen == NULL) {
+	fprintf(stderr, "Dictionary couldn't be frozen\n");
+	return false;
+    }
+    release_words(t);
+    return false;
+}
+
+/*
+ * Frozen dictionary is read-only, mutations are rejected until .reset
+ */
+static bool repl_frozen()
+{
+    if (frozen != NULL) {
+	fprintf(stderr, "Dictionary is frozen\n");
+	return true;
+    }
+    return false;
+}
+
+/*
+ * Writes snapshot of frozen dictionary, mutable trie is frozen on the fly
+ */
+static bool repl_save(trie *t, char **tokens)
+{
+    char *file_name = *(tokens + 1);
+    if (file_name == NULL) {
+	fprintf(stderr, "File name not provided\n");
+	return false;
+    }
+    dawg *d = frozen != NULL ? frozen : freeze(t);
+    if (d == NULL) {
+	fprintf(stderr, "Dictionary couldn't be frozen\n");
+	return false;
+    }
+
+    FILE *fp = fopen(file_name, "wb");
+    if (fp == NULL) {
+	fprintf(stderr, "File couldn't be opened\n");
+    } else {
+	if (!generate_snapshot_file(fp, d)) {
+	    fprintf(stderr, "Snapshot couldn't be written\n");
+	}
+	fclose(fp);
+    }
+
+    if (d != frozen) {
+	free_dawg(d);
+    }
+    return false;
+}
+
+/*
+ * Replaces current dictionary with mapped snapshot, which is read-only like frozen one
+ */
+static bool repl_open(trie *t, char **tokens)
+{
+    char *file_name = *(tokens + 1);
+    if (file_name == NULL) {
+	fprintf(stderr, "File name not provided\n");
+	return false;
+    }
+    dawg *d = open_snapshot(file_name);
+    if (d == NULL) {
+	return false;
+    }
+    free_dawg(frozen);
+    frozen = d;
+    release_words(t);
+    return false;
+}
+
+/*
+ * Only few commands take more than one argument
+ */
+static bool valid_arguments(enum REPL_COMMAND command, char **tokens)
+{
+    switch (command) {
+    case VISUALIZE:
+	return true;
+    case LOAD:
+    case TOP:
+    case SUGGEST:
+    case COUNT:
+	return *(tokens + 3) == NULL;
+    default:
+	return *(tokens + 2) == NULL;
+    }
+}
+
+/*
+ * Loads words separated by newline, each word may be followed by tab and its score.
+ * Regular files are mapped and words are inserted straight from the mapping, other files
+ * are read into memory first. Words are inserted by one worker per online CPU, or in a
+ * single pass reusing the path of previous word if file is sorted.
+ */
+void build_trie(FILE *fp, trie *t, bool sorted)
 {
-    char * line = NULL;
-    size_t len = 0;
+    struct stat st;
+    if (fstat(fileno(fp), &st) == -1) {
+	fprintf(stderr, "File couldn't be read\n");
+	return;
+    }
+
+    size_t len = st.st_size;
+    char *mapping = NULL;
+    char *text;
+    if (S_ISREG(st.st_mode) && len > 0
+	&& (mapping = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(fp), 0)) != MAP_FAILED) {
+	madvise(mapping, len, MADV_SEQUENTIAL);
+	madvise(mapping, len, MADV_WILLNEED);
+	text = mapping;
+    } else {
+	mapping = NULL;
+	text = read_file(fp, &len);
+	if (text == NULL) {
+	    return;
+	}
+    }
 
 #ifdef DEBUG
     printf("[DEBUG] Started to load file\n");
 #endif
 
-    while (getline(&line, &len, fp) != -1) {
-	if (line[0] == '#') continue;
-	line[strcspn(line, "\n")] = 0;
-	if (!put(t, line)) {
-#ifdef DEBUG
-	    printf("[DEBUG] Ignoring invalid word %s\n", line);
-#endif
+    // char after last word must be readable, unterminated last line of mapping is copied
+    size_t body = len;
+    char *tail = NULL;
+    if (mapping != NULL && text[len - 1] != '\n') {
+	const char *last = memrchr(text, '\n', len);
+	body = last != NULL ? (size_t) (last - text) + 1 : 0;
+	tail = malloc(len - body + 1);
+	if (tail == NULL) {
+	    fprintf(stderr, "Memory allocation error\n");
+	    munmap(mapping, len);
+	    return;
 	}
-#ifdef DEBUG
-	else {
-	    printf("[DEBUG] Loading word - %s\n", line);
-	    visualize_trie_debug(t);
+	memcpy(tail, text + body, len - body);
+	tail[len - body] = '\0';
+    }
+
+    bulk_word *words = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    if (scan_words(text, body, &words, &count, &capacity)
+	&& (tail == NULL || scan_words(tail, len - body, &words, &count, &capacity))) {
+	unsigned int added;
+	if (sorted) {
+	    added = put_sorted(t, words, count);
+	} else {
+	    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	    added = put_parallel(t, words, count, cpus > 0 ? cpus : 1);
 	}
+#ifdef DEBUG
+	printf("[DEBUG] Loaded %u new words\n", added);
+	visualize_trie_debug(t);
+#else
+	(void) added;
 #endif
     }
 
-    if (line) {
-        free(line);
+    free(words);
+    free(tail);
+    if (mapping != NULL) {
+	munmap(mapping, len);
+    } else {
+	free(text);
+    }
+}
+
+/*
+ * Reads the rest of file into NUL terminated buffer
+ */
+static char *read_file(FILE *fp, size_t *len)
+{
+    size_t capacity = BUFFER_SIZE;
+    char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+	fprintf(stderr, "Memory allocation error\n");
+	return NULL;
+    }
+
+    *len = 0;
+    size_t n;
+    while ((n = fread(buffer + *len, 1, capacity - *len - 1, fp)) > 0) {
+	*len += n;
+	if (capacity - *len - 1 == 0) {
+	    capacity *= 2;
+	    char *grown = realloc(buffer, capacity);
+	    if (grown == NULL) {
+		fprintf(stderr, "Memory allocation error\n");
+		free(buffer);
+		return NULL;
+	    }
+	    buffer = grown;
+	}
+    }
+    buffer[*len] = '\0';
+    return buffer;
+}
+
+/*
+ * Splits text into lines in place, words point into text and are not copied
+ */
+static bool scan_words(const char *text, size_t len, bulk_word **words, size_t *count, size_t *capacity)
+{
+    const char *end = text + len;
+    const char *line = text;
+    while (line < end) {
+	const char *eol = memchr(line, '\n', end - line);
+	if (eol == NULL) {
+	    eol = end;
+	}
+	if (*count == *capacity) {
+	    size_t grown_capacity = *capacity > 0 ? *capacity * 2 : BUFFER_SIZE;
+	    bulk_word *grown = realloc(*words, sizeof(bulk_word) * grown_capacity);
+	    if (grown == NULL) {
+		fprintf(stderr, "Memory allocation error\n");
+		return false;
+	    }
+	    *words = grown;
+	    *capacity = grown_capacity;
+	}
+	if (line[0] != '#') {
+	    if (parse_word_line(line, eol, &(*words)[*count])) {
+		(*count)++;
+	    }
+#ifdef DEBUG
+	    else {
+		printf("[DEBUG] Ignoring invalid line %.*s\n", (int) (eol - line), line);
+	    }
+#endif
+	}
+	line = eol + 1;
     }
+    return true;
 }
 
 static enum REPL_COMMAND get_command(const char *token)
@@ -344,6 +981,22 @@ static enum REPL_COMMAND get_command(const char *token)
 	return RESET;
     if (strncmp(token, ".generate", COMMAND_STRNCMP_LEN(".generate")) == 0)
 	return GENERATE;
+    if (strncmp(token, ".freeze", COMMAND_STRNCMP_LEN(".freeze")) == 0)
+	return FREEZE;
+    if (strncmp(token, ".save", COMMAND_STRNCMP_LEN(".save")) == 0)
+	return SAVE;
+    if (strncmp(token, ".top", COMMAND_STRNCMP_LEN(".top")) == 0)
+	return TOP;
+    if (strncmp(token, ".suggest", COMMAND_STRNCMP_LEN(".suggest")) == 0)
+	return SUGGEST;
+    if (strncmp(token, ".stats", COMMAND_STRNCMP_LEN(".stats")) == 0)
+	return STATS;
+    if (strncmp(token, ".session", COMMAND_STRNCMP_LEN(".session")) == 0)
+	return SESSION;
+    if (strncmp(token, ".count", COMMAND_STRNCMP_LEN(".count")) == 0)
+	return COUNT;
+    if (strncmp(token, ".open", COMMAND_STRNCMP_LEN(".open")) == 0)
+	return OPEN;
 #ifdef DEBUG
     if (strncmp(token, ".print", COMMAND_STRNCMP_LEN(".print")) == 0)
 	return PRINT;
@@ -354,3 +1007,29 @@ static enum REPL_COMMAND get_command(const char *token)
 	return QUIT;
     return COMPLETION;
 }
+
+/*
+ * Parses "word" or "word<TAB>score" line ending at eol, word is validated on insertion
+ */
+static bool parse_word_line(const char *line, const char *eol, bulk_word *bw)
+{
+    const char *tab = memchr(line, '\t', eol - line);
+    *bw = (bulk_word) { .word = line, .len = (tab != NULL ? tab : eol) - line,
+			.score = 0, .scored = false };
+    if (tab == NULL) {
+	return true;
+    }
+    if (tab + 1 == eol) {
+	return false;
+    }
+    unsigned int score = 0;
+    for (const char *digit = tab + 1; digit < eol; digit++) {
+	if (*digit < '0' || *digit > '9' || score > (UINT_MAX - (*digit - '0')) / 10) {
+	    return false;
+	}
+	score = score * 10 + (*digit - '0');
+    }
+    bw->score = score;
+    bw->scored = true;
+    return true;
+}
@@ -11,12 +11,49 @@
 
 #define COMMAND_PROMPT "\x1B[33m> \x1B[0m"
 
+/*
+ * Size of blocks in which batch input is read
+ */
+#define BATCH_BLOCK_SIZE (1 << 20)
+
 #define FREE_INPUT(tokens, line)		\
     free(tokens);				\
     free(line);
 
+/*
+ * Framing of words printed by commands
+ */
+enum OUTPUT_FORMAT {
+    /* Each word is followed by newline */
+    OUTPUT_NEWLINE,
+    /* Each word is followed by NUL */
+    OUTPUT_NUL,
+    /* Each word is preceded by its length as 4-byte little-endian integer */
+    OUTPUT_LENGTH
+};
+
+/*
+ * Reader of non-interactive input, which is read in large blocks and split into lines in place
+ */
+typedef struct
+{
+    FILE *fp;
+    char *buf;
+    size_t capacity;
+    size_t start; // first char of the next line
+    size_t end; // end of read data
+    bool eof;
+} batch_reader;
+
 char *get_line();
 char **parse_line(char *line);
 bool execute(trie *trie, char **tokens);
+void build_trie(FILE *fp, trie *t, bool sorted);
+void set_output_format(enum OUTPUT_FORMAT format);
+void end_output_record();
+bool batch_reader_init(batch_reader *r, FILE *fp);
+char *batch_next_line(batch_reader *r);
+void batch_reader_free(batch_reader *r);
+bool execute_batch(trie *t, FILE *fp);
 
 #endif // REPL_H
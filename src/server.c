@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+
+/*
+ * Number of events handled per epoll_wait call
+ */
+#define SERVE_MAX_EVENTS 64
+
+/*
+ * Largest accepted payload: operation, completion limit and word
+ */
+#define SERVE_MAX_PAYLOAD (1 + 4 + MAX_WORD_LEN)
+
+/*
+ * Input buffer of a client holds one request of largest size
+ */
+#define SERVE_INPUT_SIZE (4 + SERVE_MAX_PAYLOAD)
+
+/*
+ * Client isn't read while this many response bytes wait to be sent,
+ * so slow readers can't grow memory of the server
+ */
+#define SERVE_OUTPUT_HIGH_WATER (64 * 1024)
+
+typedef struct
+{
+    int fd;
+    uint32_t events; // epoll events client is registered for
+    char in[SERVE_INPUT_SIZE];
+    size_t in_len;
+    char *out;
+    size_t out_start; // first unsent byte
+    size_t out_len;
+    size_t out_capacity;
+} client;
+
+/*
+ * Completion callback context, words are appended to client output
+ */
+typedef struct
+{
+    client *c;
+    unsigned int left;
+    bool ok;
+} response_ctx;
+
+static void accept_clients(int epfd, int listener);
+static bool read_client(trie *t, client *c);
+static bool serve_client(trie *t, client *c);
+static bool process_requests(trie *t, client *c);
+static bool handle_request(trie *t, client *c, const char *payload, size_t len);
+static bool write_client(client *c);
+static bool update_events(int epfd, client *c);
+static void close_client(int epfd, client *c);
+static bool append_output(client *c, const void *data, size_t len);
+static bool append_word(client *c, const char *word, size_t len);
+static bool emit_completion(const char *word, size_t len, void *ctx);
+static uint32_t read_u32(const char *p);
+static void stop_serving(int sig);
+
+static volatile sig_atomic_t stopped = 0;
+
+/*
+ * Serves requests of any number of clients connected to UNIX socket at path, until
+ * SIGINT or SIGTERM. Clients are multiplexed by a single epoll loop, so requests are
+ * executed one at a time and need no locking.
+ */
+int serve(trie *t, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+	fprintf(stderr, "Socket path is too long\n");
+	return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // socket left by a previous server is replaced, other files are not touched
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+	unlink(path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener == -1 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == -1
+	|| listen(listener, SOMAXCONN) == -1) {
+	perror("Socket couldn't be opened");
+	if (listener != -1) {
+	    close(listener);
+	}
+	return 1;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev) == -1) {
+	perror("Event loop couldn't be started");
+	if (epfd != -1) {
+	    close(epfd);
+	}
+	close(listener);
+	unlink(path);
+	return 1;
+    }
+
+    struct sigaction sa = { .sa_handler = stop_serving };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    while (!stopped) {
+	int count = epoll_wait(epfd, events, SERVE_MAX_EVENTS, -1);
+	if (count == -1) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    perror("Event loop failed");
+	    break;
+	}
+	for (int i = 0; i < count; i++) {
+	    client *c = events[i].data.ptr;
+	    if (c == NULL) {
+		accept_clients(epfd, listener);
+		continue;
+	    }
+	    bool ok = true;
+	    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		ok = read_client(t, c);
+	    }
+	    if (ok && events[i].events & EPOLLOUT) {
+		ok = write_client(c) && serve_client(t, c);
+	    }
+	    if (!ok || !update_events(epfd, c)) {
+		close_client(epfd, c);
+	    }
+	}
+    }
+
+    // clients still connected are dropped with the process
+    close(epfd);
+    close(listener);
+    unlink(path);
+    return 0;
+}
+
+static void accept_clients(int epfd, int listener)
+{
+    while (true) {
+	int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1) {
+	    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		perror("Client couldn't be accepted");
+	    }
+	    return;
+	}
+	client *c = calloc(1, sizeof(client));
+	if (c == NULL) {
+	    fprintf(stderr, "Memory allocation error\n");
+	    close(fd);
+	    continue;
+	}
+	c->fd = fd;
+	c->events = EPOLLIN;
+	struct epoll_event ev = { .events = c->events, .data.ptr = c };
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+	    close(fd);
+	    free(c);
+	}
+    }
+}
+
+/*
+ * Reads available input and answers complete requests in it. Returns false if client
+ * is gone or broke the protocol.
+ */
+static bool read_client(trie *t, client *c)
+{
+    ssize_t n = recv(c->fd, c->in + c->in_len, SERVE_INPUT_SIZE - c->in_len, 0);
+    if (n == 0) {
+	return false;
+    }
+    if (n == -1) {
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    c->in_len += n;
+    return serve_client(t, c);
+}
+
+/*
+ * Answers buffered requests and sends responses, until input runs out or client stops
+ * taking output
+ */
+static bool serve_client(trie *t, client *c)
+{
+    size_t in_len;
+    do {
+	in_len = c->in_len;
+	if (!process_requests(t, c) || !write_client(c)) {
+	    return false;
+	}
+    } while (c->in_len > 0 && c->in_len < in_len
+	     && c->out_len - c->out_start < SERVE_OUTPUT_HIGH_WATER);
+    return true;
+}
+
+/*
+ * Answers buffered requests until input runs out or output reaches high water
+ */
+static bool process_requests(trie *t, client *c)
+{
+    size_t pos = 0;
+    while (c->out_len - c->out_start < SERVE_OUTPUT_HIGH_WATER && c->in_len - pos >= 4) {
+	uint32_t len = read_u32(c->in + pos);
+	if (len == 0 || len > SERVE_MAX_PAYLOAD) {
+	    return false;
+	}
+	if (c->in_len - pos - 4 < len) {
+	    break;
+	}
+	if (!handle_request(t, c, c->in + pos + 4, len)) {
+	    return false;
+	}
+	pos += 4 + len;
+    }
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+    return true;
+}
+
+static bool handle_request(trie *t, client *c, const char *payload, size_t len)
+{
+    char op = payload[0];
+    unsigned int limit = SERVE_MAX_COMPLETIONS;
+    payload++;
+    len--;
+    if (op == SERVE_COMPLETE) {
+	if (len < 4) {
+	    return false;
+	}
+	uint32_t requested = read_u32(payload);
+	if (requested > 0 && requested < limit) {
+	    limit = requested;
+	}
+	payload += 4;
+	len -= 4;
+    }
+    char word[len + 1];
+    memcpy(word, payload, len);
+    word[len] = '\0';
+
+    unsigned char status;
+    switch (op) {
+    case SERVE_CHECK:
+	status = check(t, word) ? SERVE_OK : SERVE_FAILED;
+	break;
+    case SERVE_ADD:
+	status = put(t, word) ? SERVE_OK : SERVE_FAILED;
+	break;
+    case SERVE_DELETE:
+	status = delete(t, word) ? SERVE_OK : SERVE_FAILED;
+	break;
+    case SERVE_COMPLETE: {
+	status = SERVE_OK;
+	if (!append_output(c, &status, 1)) {
+	    return false;
+	}
+	response_ctx ctx = { .c = c, .left = limit, .ok = true };
+	complete(t, word, emit_completion, &ctx);
+	return ctx.ok && append_word(c, NULL, 0);
+    }
+    default:
+	status = SERVE_BAD_REQUEST;
+    }
+    return append_output(c, &status, 1) && append_word(c, NULL, 0);
+}
+
+/*
+ * Sends as much pending output as socket takes
+ */
+static bool write_client(client *c)
+{
+    while (c->out_start < c->out_len) {
+	ssize_t n = send(c->fd, c->out + c->out_start, c->out_len - c->out_start, MSG_NOSIGNAL);
+	if (n == -1) {
+	    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	}
+	c->out_start += n;
+    }
+    c->out_start = 0;
+    c->out_len = 0;
+    // buffer grown by a large response isn't kept by idle client
+    if (c->out_capacity > SERVE_OUTPUT_HIGH_WATER) {
+	free(c->out);
+	c->out = NULL;
+	c->out_capacity = 0;
+    }
+    return true;
+}
+
+/*
+ * Waits for output space while response is pending, and for input while it isn't at high water
+ */
+static bool update_events(int epfd, client *c)
+{
+    size_t pending = c->out_len - c->out_start;
+    uint32_t events = (pending < SERVE_OUTPUT_HIGH_WATER ? EPOLLIN : 0) | (pending > 0 ? EPOLLOUT : 0);
+    if (events == c->events) {
+	return true;
+    }
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+	return false;
+    }
+    c->events = events;
+    return true;
+}
+
+static void close_client(int epfd, client *c)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->out);
+    free(c);
+}
+
+static bool append_output(client *c, const void *data, size_t len)
+{
+    if (len == 0) {
+	return true;
+    }
+    if (c->out_len + len > c->out_capacity && c->out_start > 0) {
+	// sent bytes are dropped before growing
+	memmove(c->out, c->out + c->out_start, c->out_len - c->out_start);
+	c->out_len -= c->out_start;
+	c->out_start = 0;
+    }
+    if (c->out_len + len > c->out_capacity) {
+	size_t capacity = c->out_capacity == 0 ? 4096 : c->out_capacity;
+	while (c->out_len + len > capacity) {
+	    capacity *= 2;
+	}
+	char *out = realloc(c->out, capacity);
+	if (out == NULL) {
+	    fprintf(stderr, "Memory allocation error\n");
+	    return false;
+	}
+	c->out = out;
+	c->out_capacity = capacity;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return true;
+}
+
+static bool append_word(client *c, const char *word, size_t len)
+{
+    unsigned char prefix[4] = { len & 0xFF, (len >> 8) & 0xFF, (len >> 16) & 0xFF, (len >> 24) & 0xFF };
+    return append_output(c, prefix, sizeof(prefix)) && append_output(c, word, len);
+}
+
+static bool emit_completion(const char *word, size_t len, void *ctx)
+{
+    response_ctx *r = ctx;
+    if (r->left == 0) {
+	return false;
+    }
+    r->left--;
+    r->ok = append_word(r->c, word, len);
+    return r->ok;
+}
+
+static uint32_t read_u32(const char *p)
+{
+    const unsigned char *b = (const unsigned char *) p;
+    return b[0] | (uint32_t) b[1] << 8 | (uint32_t) b[2] << 16 | (uint32_t) b[3] << 24;
+}
+
+static void stop_serving(int sig)
+{
+    (void) sig;
+    stopped = 1;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2023, Farhad Mehdizada
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "trie.h"
+
+/*
+ * Request is 4-byte little-endian payload length followed by payload, whose first byte is
+ * operation and the rest is word. Payload of SERVE_COMPLETE has 4-byte little-endian limit
+ * of completions between operation and prefix, 0 means SERVE_MAX_COMPLETIONS.
+ *
+ * Response is status byte followed by words, each preceded by its 4-byte little-endian
+ * length, and ends with zero length. Responses are sent in order of requests.
+ */
+#define SERVE_CHECK 'c'
+#define SERVE_COMPLETE 'p'
+#define SERVE_ADD 'a'
+#define SERVE_DELETE 'd'
+
+/*
+ * Upper bound of completions in a single response
+ */
+#define SERVE_MAX_COMPLETIONS 1000
+
+enum SERVE_STATUS {
+    /* Word exists, was added or deleted, or completions follow */
+    SERVE_OK,
+    /* Word doesn't exist or is invalid */
+    SERVE_FAILED,
+    /* Unknown operation */
+    SERVE_BAD_REQUEST
+};
+
+int serve(trie *t, const char *path);
+
+#endif // SERVER_H
@@ -1,33 +1,66 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "trie.h"
+#include "dawg.h"
+#include "repl.h"
+#include "server.h"
 
-static void node_test(const char *word, int n_ch, ...)
+#define SNAPSHOT_TEST_FILE "/tmp/fcmpl_test.dawg"
+#define JOURNAL_TEST_FILE "/tmp/fcmpl_test.journal"
+#define SERVER_TEST_SOCKET "/tmp/fcmpl_test.sock"
+
+/*
+ * Bulk word of string literal, optionally scored
+ */
+#define BULK_WORD(w) { .word = (w), .len = sizeof(w) - 1 }
+#define BULK_SCORED_WORD(w, s) { .word = (w), .len = sizeof(w) - 1, .score = (s), .scored = true }
+
+/*
+ * Capital letters are not in the alphabet of ALPHABET_LOWER preset
+ */
+#define CAPITALS (ALPHABET != ALPHABET_LOWER)
+
+/*
+ * Concatenates edge labels of n_nodes nodes and compares result with word
+ */
+static void node_test(const char *word, int n_nodes, ...)
 {
-    char res[n_ch + 1];
+    char res[n_nodes * MAX_LABEL_LEN + 1];
+    size_t len = 0;
     va_list ptr;
-    va_start(ptr, n_ch);
-    for (int i = 0; i < n_ch; i++) {
-	res[i] = va_arg(ptr, int);
+    va_start(ptr, n_nodes);
+    for (int i = 0; i < n_nodes; i++) {
+	const node *n = va_arg(ptr, const node *);
+	memcpy(res + len, n->label, n->len);
+	len += n->len;
     }
-    res[n_ch] = '\0';
+    res[len] = '\0';
     va_end(ptr);
 
     assert(strcmp(word, res) == 0);
 }
 
 /*
- * Stars (*) indicates word terminator (eow)
+ * Stars (*) indicates word terminator (eow), single-child chains are compressed into one node
 
        .
     /  |  \
-   A*  C   D
-  /    |    \
- B*    A     B*
- / \   |
-C*  Z* B*
+   A*  CAB* DB*
+  /
+ B*
+ / \
+C*  Z*
 |
 D*
 
@@ -46,9 +79,9 @@ static void put_test(trie *trie)
     assert(trie->size == 7);
 
     assert(!put(trie, ""));
-    assert(!put(trie, "."));
-    assert(!put(trie, ".,m"));
-    assert(!put(trie, "m./,"));
+    assert(!put(trie, " "));
+    assert(!put(trie, " ,m"));
+    assert(!put(trie, "m /,"));
     assert(trie->size == 7);
 
     int aidx = hash('a');
@@ -58,34 +91,29 @@ static void put_test(trie *trie)
     int zidx = hash('z');
 
     node *root = trie->root;
-    node *l1_a = *(root->children + aidx);
+    node *l1_a = find_child(root, aidx);
     assert(l1_a != NULL);
-    node *l1_d = *(root->children + didx);
+    node *l1_d = find_child(root, didx);
     assert(l1_d != NULL);
-    node *l1_c = *(root->children + cidx);
+    node *l1_c = find_child(root, cidx);
     assert(l1_c != NULL);
+    assert(l1_c->count == 0 && l1_d->count == 0);
 
-    node *l2_b = *(l1_a->children + bidx);
+    node *l2_b = find_child(l1_a, bidx);
     assert(l2_b != NULL);
-    node *l2_b_1 = *(l1_d->children + bidx);
-    assert(l2_b_1 != NULL);
-    node *l2_a = *(l1_c->children + aidx);
-    assert(l2_a != NULL);
 
-    node *l3_c = *(l2_b->children + cidx);
+    node *l3_c = find_child(l2_b, cidx);
     assert(l3_c != NULL);
-    node *l3_z = *(l2_b->children + zidx);
+    node *l3_z = find_child(l2_b, zidx);
     assert(l3_z != NULL);
-    node *l3_b = *(l2_a->children + bidx);
-    assert(l3_b != NULL);
 
-    node *l4_d = *(l3_c->children + didx);
+    node *l4_d = find_child(l3_c, didx);
     assert(l4_d != NULL);
 
-    node_test("abcd", 4, l1_a->ch, l2_b->ch, l3_c->ch, l4_d->ch);
-    node_test("abz", 3, l1_a->ch, l2_b->ch, l3_z->ch);
-    node_test("db", 2, l1_d->ch, l2_b_1->ch);
-    node_test("cab", 3, l1_c->ch, l2_a->ch, l3_b->ch);
+    node_test("abcd", 4, l1_a, l2_b, l3_c, l4_d);
+    node_test("abz", 3, l1_a, l2_b, l3_z);
+    node_test("db", 1, l1_d);
+    node_test("cab", 1, l1_c);
 
     printf("All assertions passed for put\n");
 }
@@ -107,21 +135,21 @@ static void check_test(trie *trie)
     assert(!check(trie, "b"));
     assert(!check(trie, "ac"));
     assert(!check(trie, "abzd"));
-    assert(!check(trie, "."));
+    assert(!check(trie, " "));
     assert(!check(trie, "cabb"));
     assert(!check(trie, "abcde"));
     assert(!check(trie, "dbd"));
 
-    assert(!check(trie, "."));
-    assert(!check(trie, ".,m"));
-    assert(!check(trie, "m./,"));
+    assert(!check(trie, " "));
+    assert(!check(trie, " ,m"));
+    assert(!check(trie, "m /,"));
 
     printf("All assertions passed for check\n");
 }
 
 /*
  * Assuming that delete_test(trie) called after put_test(trie), so there are some data in trie to test delete function
- * DELETE_THRESHOLD is 1 for DEBUG mode, so trie should be rebalanced after every single deletion
+ * Nodes no word goes through anymore are pruned by the deletion itself
  */
 static void delete_and_rebalancing_test(trie *trie)
 {
@@ -135,38 +163,35 @@ static void delete_and_rebalancing_test(trie *trie)
 
        .
     /  |  \
-   A*  C   D
-  /    |    \
- B*    A     B*
- / \   |
-C*  Z* B*
+   A*  CAB* DB*
+  /
+ B*
+ / \
+C*  Z*
 |
 D*
 
  */
     assert(delete(trie, "ab"));
     assert(!check(trie, "ab"));
-    assert(trie->delete_threshold == 1);
     trie_size--;
 
-    assert(!delete(trie, "./,"));
-    assert(!check(trie, "./,"));
-    assert(trie->delete_threshold == 1);
+    assert(!delete(trie, " /,"));
+    assert(!check(trie, " /,"));
     assert(trie->size == trie_size);
 
     assert(!delete(trie, ""));
     assert(!check(trie, ""));
-    assert(trie->delete_threshold == 1);
     assert(trie->size == trie_size);
 /*
 
        .
     /  |  \
-   A*  C   D
-  /    |    \
- B     A     B*
-/ \    |
-C* Z*  B*
+   A*  CAB* DB*
+  /
+ B
+/ \
+C* Z*
 |
 D*
 
@@ -175,48 +200,44 @@ D*
     assert(!check(trie, "abcde"));
     assert(trie->size == trie_size);
 
+    node *l1_a = find_child(root, aidx);
+    assert(l1_a != NULL && l1_a->label[0] == 'a');
+
     assert(delete(trie, "abcd"));
-    assert(delete(trie, "abc"));
     assert(!check(trie, "abcd"));
+    assert(find_child(find_child(l1_a, hash('b')), cidx)->count == 0);
+    assert(delete(trie, "abc"));
     assert(!check(trie, "abc"));
     trie_size -= 2;
     assert(trie->size == trie_size);
-    assert(trie->delete_threshold == 3);
 /*
 
        .
     /  |  \
-   A*  C   D
-  /    |    \
- B     A     B*
-/ \    |
-C  Z*  B*
-|
-D
+   A*  CAB* DB*
+   |
+   BZ*
 
  */
-    node *l1_a = *(root->children + aidx);
-    assert(l1_a != NULL && l1_a->ch == 'a');
+    node *l2_bz = find_child(l1_a, hash('b'));
+    node_test("bz", 1, l2_bz);
+    assert(l1_a->count == 1 && l2_bz->eow && l2_bz->count == 0);
+    assert(check(trie, "abz") && check(trie, "a"));
 
     assert(delete(trie, "abz"));
-    assert(trie->delete_threshold == 4);
-    assert(delete(trie, "a")); // Rebalancing happens here
-    assert(trie->delete_threshold == 0);
+    assert(l1_a->count == 0);
+    assert(delete(trie, "a"));
 /*
 
        .
        |  \
-       C   D
-       |    \
-       A     B*
-       |
-       B*
+      CAB* DB*
 
  */
-    assert(*(root->children + aidx) == NULL);
+    assert(find_child(root, aidx) == NULL);
 
     for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
-	node *child = *(root->children + i);
+	node *child = find_child(root, i);
 	assert((i == cidx || i == didx) ?
 	       child != NULL :
 	       child == NULL);
@@ -225,14 +246,1213 @@ D
     printf("All assertions passed for delete\n");
 }
 
+/*
+ * Lookup tables of the alphabet preset are inverse of each other and keep byte order
+ */
+static void alphabet_test(void)
+{
+    int prev = -1;
+    int count = 0;
+    for (int ch = 0; ch < 256; ch++) {
+	int idx = hash((char) ch);
+	if (idx == -1) {
+	    assert(!IS_VALID_CHAR(ch));
+	    continue;
+	}
+	assert(IS_VALID_CHAR(ch) && idx == prev + 1);
+	assert((unsigned char) LETTER(idx) == ch);
+	prev = idx;
+	count++;
+    }
+    assert(count == NUMBER_OF_LETTERS);
+    assert(!IS_VALID_CHAR('\0') && !IS_VALID_CHAR('\t') && !IS_VALID_CHAR(' '));
+
+    // vector and scalar parts of map_word agree with hash, for every length and invalid position
+    char word[100];
+    unsigned char slots[100];
+    for (size_t i = 0; i < sizeof(word); i++) {
+	word[i] = LETTER(i * 7 % NUMBER_OF_LETTERS);
+    }
+    for (size_t len = 0; len <= sizeof(word); len++) {
+	memset(slots, 0xFF, sizeof(slots));
+	assert(map_word(word, len, slots));
+	for (size_t i = 0; i < len; i++) {
+	    assert(slots[i] == hash(word[i]));
+	}
+    }
+    for (size_t i = 0; i < sizeof(word); i++) {
+	char saved = word[i];
+	word[i] = ' ';
+	assert(!map_word(word, sizeof(word), slots));
+	assert(map_word(word, i, slots));
+	word[i] = saved;
+    }
+
+    printf("All assertions passed for alphabet\n");
+}
+
+/*
+ * Children of a node migrate NODE4 -> NODE16 -> NODE_FULL as fan-out grows, and back on deletion
+ */
+static void adaptive_node_test(trie *trie)
+{
+    char letters[NUMBER_OF_LETTERS];
+    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
+	letters[i] = LETTER(i);
+    }
+    char word[3] = { 'x', '\0', '\0' };
+
+    assert(put(trie, "x"));
+    node *x = find_child(trie->root, hash('x'));
+    assert(x->kind == NODE4 && x->count == 0);
+
+    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
+	word[1] = letters[i];
+	assert(put(trie, word));
+	x = find_child(trie->root, hash('x'));
+	assert(x->count == i + 1);
+	assert(x->kind == (i < 4 ? NODE4 : i < 16 ? NODE16 : NODE_FULL));
+    }
+
+    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
+	word[1] = letters[i];
+	assert(check(trie, word));
+	assert(find_child(x, hash(letters[i]))->label[0] == letters[i]);
+    }
+
+    int pos = 0;
+    node *child;
+    char prev = '\0';
+    while ((child = next_child(x, &pos)) != NULL) {
+	assert(hash(child->label[0]) > hash(prev));
+	prev = child->label[0];
+    }
+    assert(prev == letters[NUMBER_OF_LETTERS - 1]);
+
+    // layout shrinks as deletions go
+    for (int i = NUMBER_OF_LETTERS - 1; i >= 2; i--) {
+	word[1] = letters[i];
+	assert(delete(trie, word));
+	x = find_child(trie->root, hash('x'));
+	assert(x->count == i);
+	assert(x->kind == (i <= 4 ? NODE4 : i <= 16 ? NODE16 : NODE_FULL));
+    }
+    assert(x->kind == NODE4 && x->count == 2);
+    word[1] = letters[0];
+    assert(check(trie, word));
+    word[1] = letters[1];
+    assert(check(trie, word));
+    word[1] = letters[2];
+    assert(!check(trie, word));
+
+    printf("All assertions passed for adaptive nodes\n");
+}
+
+/*
+ * Single-child chains share one node, labels are split on insertion and merged back on deletion
+ */
+static void path_compression_test(trie *trie)
+{
+    reset_trie(trie);
+    node *root = trie->root;
+
+    assert(put(trie, "application"));
+    node *head = find_child(root, hash('a'));
+    node *tail = find_child(head, hash('i'));
+    node_test("application", 2, head, tail);
+    assert(head->len == MAX_LABEL_LEN && !head->eow && tail->eow);
+
+    assert(put(trie, "apply"));
+    head = find_child(root, hash('a'));
+    node_test("appl", 1, head);
+    assert(head->count == 2);
+    node_test("apply", 2, head, find_child(head, hash('y')));
+    assert(check(trie, "application") && check(trie, "apply"));
+    assert(!check(trie, "appl") && !check(trie, "applicat"));
+
+    assert(put(trie, "app"));
+    head = find_child(root, hash('a'));
+    node_test("app", 1, head);
+    assert(head->eow && head->count == 1);
+    assert(check(trie, "app") && !check(trie, "ap"));
+
+    assert(!delete(trie, "appl"));
+    assert(delete(trie, "apply"));
+
+    // "y" is pruned and "l" is left with one child, so it takes over "icat"
+    head = find_child(root, hash('a'));
+    node_test("app", 1, head);
+    node_test("application", 3, head, find_child(head, hash('l')),
+	      find_child(find_child(head, hash('l')), hash('i')));
+    assert(find_child(head, hash('l'))->len == 5);
+
+    assert(delete(trie, "app"));
+    head = find_child(root, hash('a'));
+    node_test("application", 2, head, find_child(head, hash('i')));
+    assert(head->len == MAX_LABEL_LEN && head->count == 1);
+    assert(check(trie, "application") && !check(trie, "app"));
+
+    printf("All assertions passed for path compression\n");
+}
+
+/*
+ * Every node caches best score of its subtree, which bounds top-k search
+ */
+static void score_test(trie *trie)
+{
+    reset_trie(trie);
+    node *root = trie->root;
+
+    assert(put_scored(trie, "apple", 5));
+    assert(put_scored(trie, "apply", 9));
+    assert(put(trie, "ape"));
+    assert(put_scored(trie, "banana", 3));
+    assert(trie->size == 4);
+
+    node *ap = find_child(root, hash('a'));
+    node_test("ap", 1, ap);
+    assert(ap->max_score == 9);
+    assert(find_child(root, hash('b'))->max_score == 3);
+
+    assert(put(trie, "apply"));
+    assert(trie->size == 4);
+    assert(ap->max_score == 9);
+
+    assert(put_scored(trie, "apply", 1));
+    assert(ap->max_score == 5);
+
+    assert(delete(trie, "apple"));
+    assert(ap->max_score == 1);
+    assert(put_scored(trie, "ape", 7));
+    assert(ap->max_score == 7 && !ap->eow && ap->score == 0);
+
+    printf("All assertions passed for scores\n");
+}
+
+/*
+ * Completion pages continue where previous page stopped
+ */
+static void cursor_test(trie *trie)
+{
+    reset_trie(trie);
+    const char *expected[] = { "ab", "abc", "abcd", "abz", "application", "apply" };
+    const int expected_count = 6;
+    for (int i = expected_count - 1; i >= 0; i--) {
+	assert(put(trie, expected[i]));
+    }
+    assert(put(trie, "b"));
+    // traversal buffers are sized by the longest word
+    assert(trie->max_len == strlen("application"));
+
+    char long_word[MAX_WORD_LEN + 2];
+    memset(long_word, 'a', MAX_WORD_LEN + 1);
+    long_word[MAX_WORD_LEN + 1] = '\0';
+    assert(!put(trie, long_word));
+    assert(trie->max_len == strlen("application"));
+
+    char buf[32];
+    char *words[4];
+    completion_cursor *c = complete_begin(trie, "a");
+    assert(c != NULL);
+
+    assert(complete_fill(c, buf, sizeof(buf), words, 4) == 4);
+    for (int i = 0; i < 4; i++) {
+	assert(strcmp(words[i], expected[i]) == 0);
+    }
+    assert(!complete_done(c));
+
+    // 8 bytes can't hold "application", page stops before it and keeps it for the next call
+    assert(complete_fill(c, buf, 8, words, 4) == 0);
+    assert(complete_fill(c, buf, sizeof(buf), words, 4) == 2);
+    assert(strcmp(words[0], expected[4]) == 0 && strcmp(words[1], expected[5]) == 0);
+    assert(complete_done(c));
+    assert(complete_fill(c, buf, sizeof(buf), words, 4) == 0);
+    complete_end(c);
+
+    c = complete_begin(trie, "appl");
+    assert(complete_fill(c, buf, sizeof(buf), words, 4) == 2);
+    assert(strcmp(words[0], "application") == 0 && strcmp(words[1], "apply") == 0);
+    complete_end(c);
+
+    c = complete_begin(trie, "x");
+    assert(c != NULL && complete_done(c));
+    complete_end(c);
+    assert(complete_begin(trie, "a ") == NULL);
+
+    printf("All assertions passed for completion cursor\n");
+}
+
+/*
+ * Words passed to suggest callback, joined by spaces
+ */
+static bool join_word(const char *word, size_t len, void *ctx)
+{
+    char *joined = ctx;
+    size_t used = strlen(joined);
+    if (used > 0) {
+	joined[used++] = ' ';
+    }
+    memcpy(joined + used, word, len);
+    joined[used + len] = '\0';
+    return true;
+}
+
+static void suggest_test(trie *trie)
+{
+    reset_trie(trie);
+    assert(put(trie, "apple"));
+    assert(put_scored(trie, "apply", 4));
+    assert(put(trie, "ample"));
+    assert(put(trie, "maple"));
+    assert(put(trie, "ape"));
+    assert(put(trie, "application"));
+    assert(put(trie, "Apple") == CAPITALS);
+
+    char joined[256] = "";
+    assert(suggest(trie, "apple", 0, 10, join_word, joined) == 1);
+    assert(strcmp(joined, "apple") == 0);
+
+    // closest first, higher score first among equal distances, then alphabetically
+    joined[0] = '\0';
+    assert(suggest(trie, "apple", 1, 10, join_word, joined) == 3 + CAPITALS);
+    assert(strcmp(joined, CAPITALS ? "apple apply Apple ample" : "apple apply ample") == 0);
+
+    joined[0] = '\0';
+    assert(suggest(trie, "aple", 2, 10, join_word, joined) == 5 + CAPITALS);
+    assert(strcmp(joined, CAPITALS ? "ample ape apple maple apply Apple" : "ample ape apple maple apply") == 0);
+
+    joined[0] = '\0';
+    assert(suggest(trie, "aple", 2, 2, join_word, joined) == 2);
+    assert(strcmp(joined, "ample ape") == 0);
+
+    joined[0] = '\0';
+    assert(suggest(trie, "xyz", 2, 10, join_word, joined) == 0);
+    assert(suggest(trie, "ap e", 2, 10, join_word, joined) == 0);
+    assert(suggest(trie, "apple", 2, 0, join_word, joined) == 0);
+    assert(joined[0] == '\0');
+
+    printf("All assertions passed for suggest\n");
+}
+
+/*
+ * Stops completion after the first word
+ */
+static bool first_word(const char *word, size_t len, void *ctx)
+{
+    join_word(word, len, ctx);
+    return false;
+}
+
+/*
+ * Completion cache serves repeated prefixes, mutations drop only results of their prefixes
+ */
+static void cache_test(void)
+{
+    trie *t = create_trie();
+    assert(enable_completion_cache(t, 1 << 16));
+    assert(put(t, "apple") && put(t, "apply") && put(t, "banana"));
+
+    char joined[256] = "";
+    complete(t, "ap", join_word, joined);
+    assert(strcmp(joined, "apple apply") == 0);
+    joined[0] = '\0';
+    complete(t, "ap", join_word, joined);
+    assert(strcmp(joined, "apple apply") == 0);
+    joined[0] = '\0';
+    complete(t, "b", join_word, joined);
+    assert(strcmp(joined, "banana") == 0);
+    assert(t->cache->hits == 1 && t->cache->misses == 2 && t->cache->count == 2);
+
+    // "apex" drops result of "ap", result of "b" is kept
+    assert(put(t, "apex"));
+    assert(t->cache->count == 1);
+    joined[0] = '\0';
+    complete(t, "ap", join_word, joined);
+    assert(strcmp(joined, "apex apple apply") == 0);
+    assert(delete(t, "apple"));
+    joined[0] = '\0';
+    complete(t, "ap", join_word, joined);
+    assert(strcmp(joined, "apex apply") == 0);
+    joined[0] = '\0';
+    complete(t, "b", join_word, joined);
+    assert(strcmp(joined, "banana") == 0);
+    assert(t->cache->hits == 2 && t->cache->count == 2);
+
+    // failed mutations and score updates change no completion
+    assert(!delete(t, "apple") && !put(t, "ap x") && put_scored(t, "apex", 5));
+    assert(t->cache->count == 2);
+
+    // empty result is stored, partial result of a walk stopped by cb is not
+    complete(t, "x", join_word, joined);
+    complete(t, "x", join_word, joined);
+    assert(t->cache->hits == 3 && t->cache->count == 3);
+    joined[0] = '\0';
+    complete(t, "a", first_word, joined);
+    assert(strcmp(joined, "apex") == 0 && t->cache->count == 3);
+    joined[0] = '\0';
+    complete(t, "a", join_word, joined);
+    assert(strcmp(joined, "apex apply") == 0 && t->cache->hits == 3 && t->cache->count == 4);
+    joined[0] = '\0';
+    complete(t, "a", first_word, joined);
+    assert(strcmp(joined, "apex") == 0 && t->cache->hits == 4);
+
+    reset_trie(t);
+    assert(t->cache->count == 0 && t->cache->bytes == 0);
+    joined[0] = '\0';
+    complete(t, "ap", join_word, joined);
+    assert(joined[0] == '\0');
+    free_trie(t);
+
+    // results which don't fit into the budget are not stored
+    t = create_trie();
+    assert(enable_completion_cache(t, sizeof(cache_entry) + 8));
+    assert(put(t, "apple") && put(t, "apply"));
+    for (int i = 0; i < 2; i++) {
+	joined[0] = '\0';
+	complete(t, "ap", join_word, joined);
+	assert(strcmp(joined, "apple apply") == 0);
+    }
+    assert(t->cache->hits == 0 && t->cache->count == 0);
+    free_trie(t);
+
+    printf("All assertions passed for completion cache\n");
+}
+
+/*
+ * Session completes the same words as complete of its prefix after every keystroke
+ */
+static void session_test(trie *trie)
+{
+    reset_trie(trie);
+    const char *words[] = { "app", "apple", "application", "apply", "ban", "banana", "bandana" };
+    for (int i = 0; i < 7; i++) {
+	assert(put(trie, words[i]));
+    }
+
+    completion_session *s = session_begin(trie);
+    assert(s != NULL);
+    const char *keys = "applicationx";
+    char expected[256];
+    char joined[256];
+    for (size_t i = 0; keys[i] != '\0'; i++) {
+	assert(session_push_char(s, keys[i]));
+	char prefix[16] = "";
+	memcpy(prefix, keys, i + 1);
+	expected[0] = joined[0] = '\0';
+	complete(trie, prefix, join_word, expected);
+	session_complete(s, join_word, joined);
+	assert(strcmp(joined, expected) == 0);
+    }
+    assert(s->len == 12 && s->matched == 11);
+    assert(!session_push_char(s, ' '));
+
+    // back to "app" and over to "apply"
+    for (int i = 0; i < 9; i++) {
+	assert(session_pop_char(s));
+    }
+    joined[0] = '\0';
+    session_complete(s, join_word, joined);
+    assert(strcmp(joined, "app apple application apply") == 0);
+    assert(session_push_char(s, 'l') && session_push_char(s, 'y'));
+    joined[0] = '\0';
+    session_complete(s, join_word, joined);
+    assert(strcmp(joined, "apply") == 0);
+
+    while (session_pop_char(s)) {
+    }
+    assert(s->len == 0 && s->matched == 0);
+    joined[0] = '\0';
+    session_complete(s, join_word, joined);
+    assert(joined[0] == '\0');
+    assert(session_push_char(s, 'b') && session_push_char(s, 'a') && session_push_char(s, 'n'));
+    assert(session_push_char(s, 'd'));
+    joined[0] = '\0';
+    session_complete(s, join_word, joined);
+    assert(strcmp(joined, "bandana") == 0);
+    session_end(s);
+
+    printf("All assertions passed for completion session\n");
+}
+
+/*
+ * Checks word count of every node against its subtree, returns count of n
+ */
+static unsigned int count_words(const node *n)
+{
+    unsigned int words = n->eow;
+    int pos = 0;
+    const node *child;
+    while ((child = next_child(n, &pos)) != NULL) {
+	words += count_words(child);
+    }
+    assert(n->words == words);
+    return words;
+}
+
+static bool copy_word(const char *word, size_t len, void *ctx)
+{
+    memcpy(ctx, word, len);
+    ((char *) ctx)[len] = '\0';
+    return true;
+}
+
+/*
+ * Every word is selected at its rank and words come out in completion order
+ */
+static void select_rank_test(trie *trie)
+{
+    char prev[MAX_WORD_LEN + 1] = "";
+    char word[MAX_WORD_LEN + 1];
+    for (size_t i = 0; i < trie->size; i++) {
+	assert(select_word(trie, "", i, copy_word, word));
+	assert(rank_word(trie, word) == i);
+	assert(strcmp(prev, word) < 0);
+	strcpy(prev, word);
+    }
+    assert(!select_word(trie, "", trie->size, copy_word, word));
+}
+
+static void count_test(trie *trie)
+{
+    reset_trie(trie);
+    assert(count_prefix(trie, "") == 0 && count_words(trie->root) == 0);
+    const char *words[] = { "aa", "app", "apple", "application", "apply", "ban", "banana", "band", "bandana" };
+    for (int i = 8; i >= 0; i--) {
+	assert(put(trie, words[i]));
+    }
+    assert(put(trie, "apply") && put_scored(trie, "app", 5));
+    assert(count_words(trie->root) == 9);
+    assert(count_prefix(trie, "") == 9 && count_prefix(trie, "app") == 4 && count_prefix(trie, "appl") == 3);
+    assert(count_prefix(trie, "ban") == 4 && count_prefix(trie, "bana") == 1);
+    assert(count_prefix(trie, "c") == 0 && count_prefix(trie, "a ") == 0);
+
+    char word[MAX_WORD_LEN + 1];
+    for (size_t i = 0; i < 9; i++) {
+	assert(select_word(trie, "", i, copy_word, word) && strcmp(word, words[i]) == 0);
+	assert(rank_word(trie, words[i]) == i);
+    }
+    assert(select_word(trie, "ban", 2, copy_word, word) && strcmp(word, "band") == 0);
+    assert(select_word(trie, "appli", 0, copy_word, word) && strcmp(word, "application") == 0);
+    assert(!select_word(trie, "ban", 4, copy_word, word) && !select_word(trie, "x", 0, copy_word, word));
+
+    // absent words are ranked where they would be inserted
+    assert(rank_word(trie, "a") == 0 && rank_word(trie, "ap") == 1 && rank_word(trie, "applz") == 5);
+    assert(rank_word(trie, "banc") == 7 && rank_word(trie, "bandanas") == 9 && rank_word(trie, "zzz") == 9);
+
+    // "ban" splits into full "b" node, which shrinks and merges back on deletion
+    char grown[3] = "b";
+    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
+	grown[1] = LETTER(i);
+	assert(put(trie, grown));
+    }
+    assert(find_child(trie->root, hash('b'))->kind == NODE_FULL);
+    assert(count_words(trie->root) == trie->size && count_prefix(trie, "b") == 4 + NUMBER_OF_LETTERS);
+    select_rank_test(trie);
+    for (int i = 0; i < NUMBER_OF_LETTERS; i++) {
+	grown[1] = LETTER(i);
+	assert(delete(trie, grown));
+    }
+    assert(delete(trie, "band") && delete(trie, "apple"));
+    assert(count_words(trie->root) == 7 && count_prefix(trie, "b") == 3 && count_prefix(trie, "appl") == 2);
+    select_rank_test(trie);
+
+    printf("All assertions passed for word counts\n");
+}
+
+static void stats_test(trie *trie)
+{
+    reset_trie(trie);
+    trie_stats s;
+    collect_stats(trie, &s);
+    assert(s.words == 0 && s.nodes == 1 && s.nodes_by_kind[NODE_FULL] == 1 && s.max_depth == 0);
+    assert(s.node_bytes == sizeof(node_full) && s.reserved_bytes >= s.node_bytes);
+
+    // split leaves "h" with a single child, which fits into its label
+    assert(put(trie, "abcdefghij"));
+    assert(put(trie, "abcdefgz"));
+    assert(put(trie, "b"));
+    collect_stats(trie, &s);
+    assert(s.words == 3 && s.nodes == 6 && s.nodes_by_kind[NODE4] == 5);
+    assert(s.node_bytes == sizeof(node_full) + 5 * sizeof(node4));
+    assert(s.label_chars == strlen("abcdefghij") + strlen("z") + strlen("b"));
+    assert(s.max_depth == 3);
+    assert(s.depth_histogram[0] == 1 && s.depth_histogram[1] == 2 && s.depth_histogram[2] == 2
+	   && s.depth_histogram[3] == 1);
+    assert(s.fanout_histogram[0] == 3 && s.fanout_histogram[1] == 1 && s.fanout_histogram[2] == 2);
+    assert(s.mergeable_nodes == 1 && s.dead_nodes == 0);
+
+    assert(delete(trie, "abcdefgz"));
+    collect_stats(trie, &s);
+    assert(s.words == 2 && s.nodes == 4);
+    assert(s.mergeable_nodes == 0 && s.dead_nodes == 0);
+
+    printf("All assertions passed for stats\n");
+}
+
+static void parallel_load_test(trie *trie)
+{
+    reset_trie(trie);
+    assert(put(trie, "apple"));
+    assert(put(trie, "aa"));
+
+    const bulk_word words[] = {
+	BULK_WORD("app"), BULK_SCORED_WORD("apply", 9),
+	BULK_WORD("banana"), BULK_WORD("band"), BULK_WORD("aam"),
+	BULK_WORD("apple"), BULK_WORD("c t"), BULK_WORD(""), BULK_WORD("xyz")
+    };
+    assert(put_parallel(trie, words, sizeof(words) / sizeof(words[0]), 4) == 6);
+    assert(trie->size == 8);
+
+    const char *expected[] = { "aa", "aam", "app", "apple", "apply", "banana", "band", "xyz" };
+    char buf[64];
+    char *found[16];
+    completion_cursor *c = complete_begin(trie, "aa");
+    assert(complete_fill(c, buf, sizeof(buf), found, 16) == 2);
+    complete_end(c);
+    for (int i = 0; i < 8; i++) {
+	assert(check(trie, expected[i]));
+    }
+    assert(!check(trie, "ap") && !check(trie, "c"));
+    assert(trie->root->max_score == 9);
+    assert(count_words(trie->root) == 8);
+
+    // shards can be loaded again into existing subtrees
+    const bulk_word more[] = { BULK_WORD("application"), BULK_WORD("bandana") };
+    assert(put_parallel(trie, more, 2, 2) == 2);
+    assert(check(trie, "application") && check(trie, "bandana") && check(trie, "band"));
+    assert(trie->size == 10 && trie->max_len == strlen("application"));
+    assert(count_words(trie->root) == 10);
+
+    // loading words again reserves no pool memory
+    trie_stats before, after;
+    collect_stats(trie, &before);
+    assert(put_parallel(trie, words, sizeof(words) / sizeof(words[0]), 4) == 0);
+    assert(put_parallel(trie, more, 2, 2) == 0);
+    collect_stats(trie, &after);
+    assert(after.reserved_bytes == before.reserved_bytes && trie->size == 10);
+
+    // words point into text, each one ends at the first char which is not a letter
+    const char *text = "cat\ndog\t3\nmouse";
+    const bulk_word inplace[] = {
+	{ .word = text, .len = 3 }, { .word = text + 4, .len = 3, .score = 3, .scored = true },
+	{ .word = text + 10, .len = 3 }
+    };
+    assert(put_parallel(trie, inplace, 3, 2) == 2);
+    assert(check(trie, "cat") && check(trie, "dog") && !check(trie, "mou") && !check(trie, "mouse"));
+
+    printf("All assertions passed for parallel load\n");
+}
+
+static void sorted_load_test(trie *trie)
+{
+    reset_trie(trie);
+    assert(put(trie, "bank"));
+
+    // "aardvark" is out of order and is inserted from root
+    const bulk_word words[] = {
+	BULK_WORD("aa"), BULK_WORD("app"), BULK_SCORED_WORD("apple", 4),
+	BULK_WORD("application"), BULK_SCORED_WORD("apply", 9),
+	BULK_SCORED_WORD("apply", 2), BULK_WORD("ban"), BULK_WORD("ba d"),
+	BULK_WORD("bank"), BULK_WORD("banking"), BULK_WORD("aardvark"), BULK_WORD("zero")
+    };
+    assert(put_sorted(trie, words, sizeof(words) / sizeof(words[0])) == 9);
+    assert(trie->size == 10);
+
+    const char *expected[] = { "aa", "aardvark", "app", "apple", "application", "apply",
+			       "ban", "bank", "banking", "zero" };
+    char buf[128];
+    char *found[16];
+    completion_cursor *c = complete_begin(trie, "aa");
+    assert(complete_fill(c, buf, sizeof(buf), found, 16) == 2);
+    assert(strcmp(found[0], expected[0]) == 0 && strcmp(found[1], expected[1]) == 0);
+    complete_end(c);
+    for (int i = 0; i < 10; i++) {
+	assert(check(trie, expected[i]));
+    }
+    assert(!check(trie, "appl") && !check(trie, "banki"));
+    assert(count_words(trie->root) == 10);
+
+    // lowered score of "apply" leaves "apple" as the best word
+    assert(find_child(trie->root, hash('a'))->max_score == 4);
+    assert(trie->root->max_score == 4);
+
+#if ALPHABET == ALPHABET_BYTES
+    // bytes above 0x7F come after ASCII
+    reset_trie(trie);
+    const bulk_word high[] = { BULK_WORD("ab"), BULK_WORD("a\xe9"), BULK_WORD("a\xe9t") };
+    assert(put_sorted(trie, high, 3) == 3);
+    c = complete_begin(trie, "a");
+    assert(complete_fill(c, buf, sizeof(buf), found, 16) == 3);
+    assert(strcmp(found[0], "ab") == 0 && strcmp(found[2], "a\xe9t") == 0);
+    complete_end(c);
+#endif
+
+    printf("All assertions passed for sorted load\n");
+}
+
+static const char *stable_words[] = { "apple", "apply", "ape", "banana", "zoo" };
+
+static void *concurrent_reader(void *arg)
+{
+    trie *t = arg;
+    long misses = 0;
+    for (int i = 0; i < 20000; i++) {
+	for (int j = 0; j < 5; j++) {
+	    misses += !check(t, stable_words[j]);
+	}
+	if (i % 100 == 0) {
+	    char joined[4096] = "";
+	    complete(t, "app", join_word, joined);
+	    misses += strstr(joined, "apple") == NULL || strstr(joined, "apply") == NULL;
+	    misses += count_prefix(t, "ap") < 3;
+	}
+    }
+    return (void *) misses;
+}
+
+/*
+ * Readers never miss stable words while writer keeps inserting and deleting words which
+ * share nodes with them (sweeps, splits, merges and node growth all happen underneath)
+ */
+static void concurrent_test(void)
+{
+    trie *t = create_trie();
+    assert(enable_concurrent_mode(t) && enable_completion_cache(t, 1 << 16));
+    for (int j = 0; j < 5; j++) {
+	assert(put(t, stable_words[j]));
+    }
+
+    pthread_t readers[4];
+    for (int i = 0; i < 4; i++) {
+	assert(pthread_create(&readers[i], NULL, concurrent_reader, t) == 0);
+    }
+    char word[8] = "ap";
+    for (int i = 0; i < 3000; i++) {
+	word[2] = 'a' + i % 26;
+	word[3] = LETTER(i / 26 % 26);
+	word[4] = i % 3 == 0 ? '\0' : 'x';
+	word[5] = '\0';
+	assert(put(t, word));
+	if (i % 2 == 1) {
+	    assert(delete(t, word));
+	}
+    }
+    for (int i = 0; i < 4; i++) {
+	void *misses;
+	pthread_join(readers[i], &misses);
+	assert(misses == NULL);
+    }
+    for (int j = 0; j < 5; j++) {
+	assert(check(t, stable_words[j]));
+    }
+    free_trie(t);
+
+    printf("All assertions passed for concurrent mode\n");
+}
+
+/*
+ * Snapshot of d with 4 bytes at offset replaced by value opens, but words behind the broken
+ * state or edge read as missing
+ */
+static void corrupt_snapshot_test(const dawg *d, long offset, uint32_t value)
+{
+    FILE *fp = fopen(SNAPSHOT_TEST_FILE, "wb");
+    assert(fp != NULL);
+    assert(generate_snapshot_file(fp, d));
+    assert(fseek(fp, offset, SEEK_SET) == 0 && fwrite(&value, sizeof(value), 1, fp) == 1);
+    fclose(fp);
+
+    dawg *mapped = open_snapshot(SNAPSHOT_TEST_FILE);
+    assert(mapped != NULL);
+    assert(!dawg_check(mapped, "talking") && !dawg_check(mapped, "talked"));
+    char joined[256] = "";
+    dawg_complete(mapped, "t", join_word, joined);
+    assert(strcmp(joined, "") == 0);
+    fp = tmpfile();
+    assert(fp != NULL);
+    generate_dawg_txt_file(fp, mapped);
+    fclose(fp);
+    free_dawg(mapped);
+}
+
+/*
+ * Shared suffixes of frozen dictionary are stored once
+
+ . -w/t-> . -a-> . -l-> . -k-> . -i-> . -n-> . -g-> *
+                                \-e-> . -d-------->/
+
+ */
+static void freeze_test(trie *trie)
+{
+    reset_trie(trie);
+    assert(put(trie, "walking"));
+    assert(put(trie, "talking"));
+    assert(put(trie, "walked"));
+    assert(put(trie, "talked"));
+
+    dawg *d = freeze(trie);
+    assert(d != NULL);
+    assert(d->size == 4);
+    assert(d->state_count == 9);
+    assert(d->states[d->root].edge_count == 2);
+
+    assert(dawg_check(d, "walking") && dawg_check(d, "talking"));
+    assert(dawg_check(d, "walked") && dawg_check(d, "talked"));
+    assert(!dawg_check(d, "walk") && !dawg_check(d, "talkings"));
+    assert(!dawg_check(d, "") && !dawg_check(d, "wal ed"));
+
+    FILE *fp = fopen(SNAPSHOT_TEST_FILE, "wb");
+    assert(fp != NULL);
+    assert(generate_snapshot_file(fp, d));
+    fclose(fp);
+
+    dawg *mapped = open_snapshot(SNAPSHOT_TEST_FILE);
+    assert(mapped != NULL && mapped->mapping != NULL);
+    assert(mapped->size == 4 && mapped->state_count == 9);
+    assert(dawg_check(mapped, "walking") && dawg_check(mapped, "talked"));
+    assert(!dawg_check(mapped, "walk"));
+    free_dawg(mapped);
+
+    // edge back to root forms a cycle, others leave the arrays
+    long states = sizeof(snapshot_header);
+    long edges = states + sizeof(dawg_state) * d->state_count;
+    long root_edge = edges + sizeof(dawg_edge) * d->states[d->root].first_edge;
+    corrupt_snapshot_test(d, root_edge + offsetof(dawg_edge, target), d->root);
+    corrupt_snapshot_test(d, root_edge + offsetof(dawg_edge, target), d->state_count);
+    corrupt_snapshot_test(d, states + sizeof(dawg_state) * d->root + offsetof(dawg_state, first_edge),
+			  d->edge_count - 1);
+    free_dawg(d);
+    remove(SNAPSHOT_TEST_FILE);
+
+    printf("All assertions passed for freeze\n");
+}
+
+static long file_size(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    assert(fp != NULL);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+/*
+ * Reopened trie replays mutations of the previous one, torn tail is cut off
+ * and compaction, on demand or in the background, keeps words while dropping their history
+ */
+static void journal_test(void)
+{
+    remove(JOURNAL_TEST_FILE);
+    trie *t = create_trie();
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(put(t, "apple") && put_scored(t, "apply", 9) && put(t, "banana") && put(t, "band"));
+    assert(delete(t, "banana") && !delete(t, "banana"));
+    const bulk_word words[] = { BULK_WORD("aa"), BULK_WORD("app"), BULK_SCORED_WORD("bandana", 3) };
+    assert(put_sorted(t, words, 3) == 3);
+    assert(put_scored(t, "apply", 4));
+    assert(sync_journal(t));
+    free_trie(t);
+
+    const char *expected = "aa app apple apply band bandana";
+    char joined[256] = "";
+    t = create_trie();
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(t->size == 6 && count_words(t->root) == 6 && t->root->max_score == 4);
+    assert(select_word(t, "", 0, join_word, joined) && !check(t, "banana"));
+    for (size_t i = 1; i < t->size; i++) {
+	assert(select_word(t, "", i, join_word, joined));
+    }
+    assert(strcmp(joined, expected) == 0);
+    free_trie(t);
+
+    // record torn by a crash is dropped with everything after it
+    long size = file_size(JOURNAL_TEST_FILE);
+    FILE *fp = fopen(JOURNAL_TEST_FILE, "ab");
+    assert(fp != NULL);
+    fwrite("\x02\x05\x00torn", 1, 7, fp);
+    fclose(fp);
+    t = create_trie();
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(t->size == 6 && file_size(JOURNAL_TEST_FILE) == size);
+    assert(put(t, "cat") && delete(t, "app"));
+    assert(compact_journal(t));
+    assert(file_size(JOURNAL_TEST_FILE) < size);
+    free_trie(t);
+
+    // compacted journal starts with reset, words present before replay are dropped
+    t = create_trie();
+    assert(put(t, "dog"));
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(t->size == 6 && !check(t, "dog") && !check(t, "app") && check(t, "cat"));
+    assert(t->root->max_score == 4 && count_words(t->root) == 6);
+    reset_trie(t);
+    assert(put(t, "egg"));
+    free_trie(t);
+
+    // releasing words of a frozen trie is not journaled
+    t = create_trie();
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(t->size == 1 && check(t, "egg"));
+    release_words(t);
+    assert(t->size == 0);
+    free_trie(t);
+
+    // mutations after a write failure stay in memory only and sync reports them
+    t = create_trie();
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(t->size == 1 && check(t, "egg"));
+    t->journal->failed = true;
+    assert(put(t, "fig") && check(t, "fig"));
+    assert(!sync_journal(t));
+    free_trie(t);
+
+    // mutations keep going while the flusher writes snapshot taken by one of them
+    t = create_trie();
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(t->size == 1 && check(t, "egg") && !check(t, "fig"));
+    assert(put_scored(t, "fig", 5));
+    for (int i = 0; i < 60000; i++) {
+	assert(put(t, "cat") && delete(t, "cat"));
+    }
+    assert(put(t, "cat") && sync_journal(t));
+    free_trie(t);
+
+    assert(file_size(JOURNAL_TEST_FILE) < JOURNAL_COMPACT_MIN_BYTES);
+    t = create_trie();
+    assert(enable_journal(t, JOURNAL_TEST_FILE));
+    assert(t->size == 3 && check(t, "egg") && check(t, "fig") && check(t, "cat") && t->root->max_score == 5);
+    free_trie(t);
+    remove(JOURNAL_TEST_FILE);
+
+    printf("All assertions passed for journal\n");
+}
+
+/*
+ * Writes DOT of subtree under prefix into memory and compares it with expected
+ */
+static void dot_graph_test(const trie *trie, const char *prefix, size_t max_depth, size_t drawn,
+			   const char *expected)
+{
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    assert(generate_dot_file(fp, trie, prefix, max_depth) == drawn);
+    char res[1024];
+    rewind(fp);
+    size_t len = fread(res, 1, sizeof(res) - 1, fp);
+    res[len] = '\0';
+    fclose(fp);
+    if (expected != NULL) {
+	assert(strcmp(res, expected) == 0);
+    }
+}
+
+/*
+ * Graph is limited to subtree of prefix and max depth, nodes are named by pre-order number
+ */
+static void visualize_test(trie *trie)
+{
+    reset_trie(trie);
+    assert(put(trie, "walking") && put(trie, "walked") && put(trie, "talking") && put(trie, "wall"));
+
+    const char *expected =
+	"digraph {\n"
+	"  n0 [label=\"wal\";fillcolor=red;style=filled;fontcolor=white]\n"
+	"  n1 [label=\"k\";fillcolor=black;style=filled;fontcolor=white]\n"
+	"  n0 -> n1\n"
+	"  n2 [label=\"2 words\";style=dashed]\n"
+	"  n1 -> n2\n"
+	"  n3 [label=\"l\";fillcolor=green;style=filled;fontcolor=white]\n"
+	"  n0 -> n3\n"
+	"}\n";
+    dot_graph_test(trie, "wal", 1, 4, expected);
+    dot_graph_test(trie, "wa", 1, 4, expected);
+    dot_graph_test(trie, "wal", 0, 5, NULL);
+    dot_graph_test(trie, NULL, 0, 7, NULL);
+    dot_graph_test(trie, "", 1, 4, NULL);
+    dot_graph_test(trie, "x", 0, 0, "digraph {\n}\n");
+    dot_graph_test(trie, "wa ", 0, 0, "digraph {\n}\n");
+
+#if ALPHABET == ALPHABET_BYTES
+    // quotes and backslashes of words are escaped in labels
+    reset_trie(trie);
+    assert(put(trie, "a\"b") && put(trie, "c\\"));
+    const char *escaped =
+	"digraph {\n"
+	"  n0 [label=\".\";fillcolor=red;style=filled;fontcolor=white]\n"
+	"  n1 [label=\"a\\\"b\";fillcolor=green;style=filled;fontcolor=white]\n"
+	"  n0 -> n1\n"
+	"  n2 [label=\"c\\\\\";fillcolor=green;style=filled;fontcolor=white]\n"
+	"  n0 -> n2\n"
+	"}\n";
+    dot_graph_test(trie, NULL, 0, 3, escaped);
+    dot_graph_test(trie, "a\"", 0, 1,
+		   "digraph {\n"
+		   "  n0 [label=\"a\\\"b\";fillcolor=red;style=filled;fontcolor=white]\n"
+		   "}\n");
+    reset_trie(trie);
+    assert(put(trie, "walking") && put(trie, "walked") && put(trie, "talking") && put(trie, "wall"));
+#endif
+
+    // only renderers are reaped, exit status of other children is left to the program
+    pid_t child = fork();
+    assert(child != -1);
+    if (child == 0) {
+	_exit(7);
+    }
+    visualize_trie(trie, "/tmp/fcmpl_test.svg", "wal", 1);
+    sleep(1); // renderer exits and SIGCHLD handler runs
+    int status;
+    assert(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 7);
+    remove("/tmp/fcmpl_test.svg");
+
+    printf("All assertions passed for visualize\n");
+}
+
+/*
+ * Lines are split across blocks, a line longer than a block grows the buffer and the last
+ * line may lack newline
+ */
+static void batch_reader_test(void)
+{
+    // "split" starts 2 bytes before the end of the first block
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    size_t first = BATCH_BLOCK_SIZE - 3;
+    size_t longest = 2 * BATCH_BLOCK_SIZE + 5;
+    for (size_t i = 0; i < first; i++) {
+	fputc('a', fp);
+    }
+    fputs("\nsplit\n", fp);
+    for (size_t i = 0; i < longest; i++) {
+	fputc('b', fp);
+    }
+    fputs("\n\nlast", fp);
+    rewind(fp);
+
+    batch_reader r;
+    assert(batch_reader_init(&r, fp));
+    char *line = batch_next_line(&r);
+    assert(line != NULL && strlen(line) == first && line[0] == 'a');
+    line = batch_next_line(&r);
+    assert(line != NULL && strcmp(line, "split") == 0);
+    line = batch_next_line(&r);
+    assert(line != NULL && strlen(line) == longest && line[longest - 1] == 'b');
+    line = batch_next_line(&r);
+    assert(line != NULL && *line == '\0');
+    line = batch_next_line(&r);
+    assert(line != NULL && strcmp(line, "last") == 0);
+    assert(batch_next_line(&r) == NULL);
+    batch_reader_free(&r);
+    fclose(fp);
+
+    // input of exactly one block without newline
+    fp = tmpfile();
+    assert(fp != NULL);
+    for (size_t i = 0; i < BATCH_BLOCK_SIZE; i++) {
+	fputc('c', fp);
+    }
+    rewind(fp);
+    assert(batch_reader_init(&r, fp));
+    line = batch_next_line(&r);
+    assert(line != NULL && strlen(line) == BATCH_BLOCK_SIZE);
+    assert(batch_next_line(&r) == NULL);
+    batch_reader_free(&r);
+    fclose(fp);
+}
+
+/*
+ * Runs batch commands with given framing and compares what they printed with expected
+ */
+static void batch_output_test(trie *trie, const char *input, enum OUTPUT_FORMAT format,
+			      const char *expected, size_t expected_len)
+{
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    assert(in != NULL && out != NULL);
+    fputs(input, in);
+    rewind(in);
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    assert(saved != -1 && dup2(fileno(out), STDOUT_FILENO) != -1);
+    set_output_format(format);
+    assert(execute_batch(trie, in));
+    fflush(stdout);
+    set_output_format(OUTPUT_NEWLINE);
+    assert(dup2(saved, STDOUT_FILENO) != -1);
+    close(saved);
+
+    char res[256];
+    rewind(out);
+    size_t len = fread(res, 1, sizeof(res), out);
+    assert(len == expected_len && memcmp(res, expected, len) == 0);
+    fclose(in);
+    fclose(out);
+}
+
+/*
+ * Output of every batch line ends with an empty word in each framing
+ */
+static void batch_test(trie *trie)
+{
+    batch_reader_test();
+
+    reset_trie(trie);
+    assert(put(trie, "apple") && put(trie, "apply"));
+    const char *input = "appl\n.check apple\n\n.check ap";
+    const char newline[] = "apple\napply\n\napple\n\n\n\n";
+    const char nul[] = "apple\0apply\0\0apple\0\0\0\0";
+    const char length[] = "\5\0\0\0apple\5\0\0\0apply\0\0\0\0"
+	"\5\0\0\0apple\0\0\0\0" "\0\0\0\0" "\0\0\0\0";
+    batch_output_test(trie, input, OUTPUT_NEWLINE, newline, sizeof(newline) - 1);
+    batch_output_test(trie, input, OUTPUT_NUL, nul, sizeof(nul) - 1);
+    batch_output_test(trie, input, OUTPUT_LENGTH, length, sizeof(length) - 1);
+
+    printf("All assertions passed for batch\n");
+}
+
+static size_t put_u32(char *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+    return 4;
+}
+
+/*
+ * Writes request of op on word into buf, limit is sent only for SERVE_COMPLETE
+ */
+static size_t server_request(char *buf, char op, const char *word, uint32_t limit)
+{
+    size_t len = strlen(word);
+    size_t payload = 1 + (op == SERVE_COMPLETE ? 4 : 0) + len;
+    size_t pos = put_u32(buf, payload);
+    buf[pos++] = op;
+    if (op == SERVE_COMPLETE) {
+	pos += put_u32(buf + pos, limit);
+    }
+    memcpy(buf + pos, word, len);
+    return pos + len;
+}
+
+/*
+ * Writes response of status and words into buf
+ */
+static size_t server_response(char *buf, enum SERVE_STATUS status, const char **words, size_t count)
+{
+    size_t pos = 0;
+    buf[pos++] = status;
+    for (size_t i = 0; i < count; i++) {
+	size_t len = strlen(words[i]);
+	pos += put_u32(buf + pos, len);
+	memcpy(buf + pos, words[i], len);
+	pos += len;
+    }
+    return pos + put_u32(buf + pos, 0);
+}
+
+/*
+ * Server runs in a child process, requests sent in one write are answered in order
+ */
+static void server_test(trie *trie)
+{
+    reset_trie(trie);
+    assert(put(trie, "apple") && put(trie, "apply") && put(trie, "apt"));
+    fflush(stdout);
+    pid_t server = fork();
+    assert(server != -1);
+    if (server == 0) {
+	_exit(serve(trie, SERVER_TEST_SOCKET));
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = SERVER_TEST_SOCKET };
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd != -1);
+    struct timespec pause = { .tv_nsec = 10 * 1000 * 1000 };
+    for (int i = 0; connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1; i++) {
+	assert(i < 500);
+	nanosleep(&pause, NULL);
+    }
+
+    char req[512];
+    size_t req_len = 0;
+    req_len += server_request(req + req_len, SERVE_CHECK, "apple", 0);
+    req_len += server_request(req + req_len, SERVE_COMPLETE, "ap", 2);
+    req_len += server_request(req + req_len, SERVE_ADD, "ape", 0);
+    req_len += server_request(req + req_len, SERVE_CHECK, "ape", 0);
+    req_len += server_request(req + req_len, SERVE_DELETE, "apt", 0);
+    req_len += server_request(req + req_len, SERVE_DELETE, "apt", 0);
+    req_len += server_request(req + req_len, 'x', "apple", 0);
+    req_len += server_request(req + req_len, SERVE_CHECK, "a pe", 0);
+    req_len += server_request(req + req_len, SERVE_COMPLETE, "ap", 0);
+    // last request arrives in two parts
+    size_t split = req_len + 3;
+    req_len += server_request(req + req_len, SERVE_CHECK, "apt", 0);
+
+    const char *limited[] = { "apple", "apply" };
+    const char *all[] = { "ape", "apple", "apply" };
+    char expected[512];
+    size_t expected_len = 0;
+    expected_len += server_response(expected + expected_len, SERVE_OK, NULL, 0);
+    expected_len += server_response(expected + expected_len, SERVE_OK, limited, 2);
+    expected_len += server_response(expected + expected_len, SERVE_OK, NULL, 0);
+    expected_len += server_response(expected + expected_len, SERVE_OK, NULL, 0);
+    expected_len += server_response(expected + expected_len, SERVE_OK, NULL, 0);
+    expected_len += server_response(expected + expected_len, SERVE_FAILED, NULL, 0);
+    expected_len += server_response(expected + expected_len, SERVE_BAD_REQUEST, NULL, 0);
+    expected_len += server_response(expected + expected_len, SERVE_FAILED, NULL, 0);
+    expected_len += server_response(expected + expected_len, SERVE_OK, all, 3);
+    expected_len += server_response(expected + expected_len, SERVE_FAILED, NULL, 0);
+
+    assert(send(fd, req, split, 0) == (ssize_t) split);
+    nanosleep(&pause, NULL);
+    assert(send(fd, req + split, req_len - split, 0) == (ssize_t) (req_len - split));
+    char res[512];
+    size_t res_len = 0;
+    while (res_len < expected_len) {
+	ssize_t n = recv(fd, res + res_len, sizeof(res) - res_len, 0);
+	assert(n > 0);
+	res_len += n;
+    }
+    assert(res_len == expected_len && memcmp(res, expected, expected_len) == 0);
+    close(fd);
+
+    int status;
+    assert(kill(server, SIGTERM) == 0);
+    assert(waitpid(server, &status, 0) == server && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(access(SERVER_TEST_SOCKET, F_OK) == -1);
+
+    printf("All assertions passed for server\n");
+}
+
 int main(void) {
 #ifndef DEBUG
     static_assert(0 && "DEBUG mode is not enabled");
 #endif
+    alphabet_test();
     trie *trie = create_trie();
     put_test(trie);
     check_test(trie);
     delete_and_rebalancing_test(trie);
+    adaptive_node_test(trie);
+    path_compression_test(trie);
+    score_test(trie);
+    cursor_test(trie);
+    suggest_test(trie);
+    stats_test(trie);
+    cache_test();
+    session_test(trie);
+    count_test(trie);
+    visualize_test(trie);
+    journal_test();
+    parallel_load_test(trie);
+    sorted_load_test(trie);
+    freeze_test(trie);
+    batch_test(trie);
+    server_test(trie);
+    concurrent_test();
     printf("All tests are passed\n");
     free_trie(trie);
     return 0;